@@ -39,6 +39,7 @@ ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	obj_state(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -71,6 +72,7 @@ ModelAction::ModelAction(action_type_t type, memory_order order, uint64_t value,
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	obj_state(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -102,6 +104,7 @@ ModelAction::ModelAction(action_type_t type, memory_order order, void *loc,
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	obj_state(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -136,6 +139,7 @@ ModelAction::ModelAction(action_type_t type, const char * position, memory_order
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	obj_state(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -171,6 +175,7 @@ ModelAction::ModelAction(action_type_t type, const char * position, memory_order
 	cv(NULL),
 	rf_cv(NULL),
 	action_ref(NULL),
+	obj_state(NULL),
 	value(value),
 	type(type),
 	order(order),
@@ -196,7 +196,10 @@ public:
 	void setActionRef(sllnode<ModelAction *> *ref) { action_ref = ref; }
 	sllnode<ModelAction *> * getActionRef() { return action_ref; }
 
-	SNAPSHOTALLOC
+	void set_obj_state(ObjectState *state) { obj_state = state; }
+	ObjectState * get_obj_state() const { return obj_state; }
+
+	SNAPSHOTPOOLALLOC
 private:
 	const char * get_type_str() const;
 	const char * get_mo_str() const;
@@ -232,6 +235,9 @@ private:
 	ClockVector *rf_cv;
 	sllnode<ModelAction *> * action_ref;
 
+	/** @brief The per-object state of the location, once looked up */
+	ObjectState *obj_state;
+
 	/** @brief The value written (for write or RMW; undefined for read) */
 	uint64_t value;
 
@@ -19,7 +19,7 @@ class allnode {
 public:
 	allnode();
 	~allnode();
-	SNAPSHOTALLOC;
+	SNAPSHOTPOOLALLOC;
 
 private:
 	allnode * parent;
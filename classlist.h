@@ -27,6 +27,7 @@ class actionlist;
 #include "actionlist.h"
 
 struct model_snapshot_members;
+struct ObjectState;
 struct bug_message;
 
 typedef SnapList<ModelAction *> simple_action_list_t;
@@ -1,5 +1,8 @@
 #include <cstring>
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #include "action.h"
 
@@ -7,6 +10,123 @@
 #include "common.h"
 #include "threads-model.h"
 
+/**
+ * @brief Sets each clock of dst, from index i on, to the maximum of it and
+ * the clock of src
+ * @return Whether dst changed
+ */
+static bool max_clocks(modelclock_t *dst, const modelclock_t *src, int i, int n)
+{
+	bool changed = false;
+#ifdef __SSE2__
+	/* SSE2 only compares signed words: flip the sign bits first */
+	const __m128i bias = _mm_set1_epi32(0x80000000);
+	for (;i + 4 <= n;i += 4) {
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+		__m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(v, bias), _mm_xor_si128(d, bias));
+		if (_mm_movemask_epi8(gt) != 0) {
+			_mm_storeu_si128((__m128i *)&dst[i], _mm_or_si128(_mm_and_si128(gt, v), _mm_andnot_si128(gt, d)));
+			changed = true;
+		}
+	}
+#endif
+	for (;i < n;i++)
+		if (src[i] > dst[i]) {
+			dst[i] = src[i];
+			changed = true;
+		}
+	return changed;
+}
+
+/**
+ * @brief Sets each clock of dst, from index i on, to the minimum of it and
+ * the clock of src
+ * @return Whether dst changed
+ */
+static bool min_clocks(modelclock_t *dst, const modelclock_t *src, int i, int n)
+{
+	bool changed = false;
+#ifdef __SSE2__
+	const __m128i bias = _mm_set1_epi32(0x80000000);
+	for (;i + 4 <= n;i += 4) {
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+		__m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i lt = _mm_cmpgt_epi32(_mm_xor_si128(d, bias), _mm_xor_si128(v, bias));
+		if (_mm_movemask_epi8(lt) != 0) {
+			_mm_storeu_si128((__m128i *)&dst[i], _mm_or_si128(_mm_and_si128(lt, v), _mm_andnot_si128(lt, d)));
+			changed = true;
+		}
+	}
+#endif
+	for (;i < n;i++)
+		if (src[i] < dst[i]) {
+			dst[i] = src[i];
+			changed = true;
+		}
+	return changed;
+}
+
+static bool max_clocks_default(modelclock_t *dst, const modelclock_t *src, int n)
+{
+	return max_clocks(dst, src, 0, n);
+}
+
+static bool min_clocks_default(modelclock_t *dst, const modelclock_t *src, int n)
+{
+	return min_clocks(dst, src, 0, n);
+}
+
+#ifdef __SSE2__
+/* Built for AVX2 whatever the build flags; only used if the CPU has it */
+__attribute__((target("avx2")))
+static bool max_clocks_avx2(modelclock_t *dst, const modelclock_t *src, int n)
+{
+	int i = 0;
+	bool changed = false;
+	for (;i + 8 <= n;i += 8) {
+		__m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+		__m256i m = _mm256_max_epu32(d, _mm256_loadu_si256((const __m256i *)&src[i]));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(m, d)) != -1) {
+			_mm256_storeu_si256((__m256i *)&dst[i], m);
+			changed = true;
+		}
+	}
+	return max_clocks(dst, src, i, n) || changed;
+}
+
+__attribute__((target("avx2")))
+static bool min_clocks_avx2(modelclock_t *dst, const modelclock_t *src, int n)
+{
+	int i = 0;
+	bool changed = false;
+	for (;i + 8 <= n;i += 8) {
+		__m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+		__m256i m = _mm256_min_epu32(d, _mm256_loadu_si256((const __m256i *)&src[i]));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(m, d)) != -1) {
+			_mm256_storeu_si256((__m256i *)&dst[i], m);
+			changed = true;
+		}
+	}
+	return min_clocks(dst, src, i, n) || changed;
+}
+#endif
+
+/** @brief The merge kernels for this CPU, chosen by initClockVectors() */
+static bool (*merge_max)(modelclock_t *dst, const modelclock_t *src, int n) = max_clocks_default;
+static bool (*merge_min)(modelclock_t *dst, const modelclock_t *src, int n) = min_clocks_default;
+
+/** @brief Chooses the merge kernels for the CPU we run on */
+void initClockVectors()
+{
+#ifdef __SSE2__
+	if (__builtin_cpu_supports("avx2")) {
+		merge_max = max_clocks_avx2;
+		merge_min = min_clocks_avx2;
+	}
+#endif
+}
+
 
 /**
  * Constructs a new ClockVector, given a parent ClockVector and a first
@@ -22,7 +142,12 @@ ClockVector::ClockVector(ClockVector *parent, const ModelAction *act)
 	if (parent && parent->num_threads > num_threads)
 		num_threads = parent->num_threads;
 
-	clock = (modelclock_t *)snapshot_calloc(num_threads, sizeof(int));
+	if (num_threads <= CLOCKVECTOR_INLINE_THREADS) {
+		clock = inline_clock;
+		std::memset(clock, 0, sizeof(inline_clock));
+	} else {
+		clock = (modelclock_t *)snapshot_calloc(num_threads, sizeof(modelclock_t));
+	}
 	if (parent)
 		std::memcpy(clock, parent->clock, parent->num_threads * sizeof(modelclock_t));
 
@@ -33,7 +158,24 @@ ClockVector::ClockVector(ClockVector *parent, const ModelAction *act)
 /** @brief Destructor */
 ClockVector::~ClockVector()
 {
-	snapshot_free(clock);
+	if (clock != inline_clock)
+		snapshot_free(clock);
+}
+
+/** @brief Extends the vector to a number of threads, with zero clocks */
+void ClockVector::grow(int threads)
+{
+	if (threads > CLOCKVECTOR_INLINE_THREADS) {
+		if (clock == inline_clock) {
+			clock = (modelclock_t *)snapshot_malloc(threads * sizeof(modelclock_t));
+			std::memcpy(clock, inline_clock, num_threads * sizeof(modelclock_t));
+		} else {
+			clock = (modelclock_t *)snapshot_realloc(clock, threads * sizeof(modelclock_t));
+		}
+	}
+	for (int i = num_threads;i < threads;i++)
+		clock[i] = 0;
+	num_threads = threads;
 }
 
 /**
@@ -44,22 +186,11 @@ ClockVector::~ClockVector()
 bool ClockVector::merge(const ClockVector *cv)
 {
 	ASSERT(cv != NULL);
-	bool changed = false;
-	if (cv->num_threads > num_threads) {
-		clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
-		for (int i = num_threads;i < cv->num_threads;i++)
-			clock[i] = 0;
-		num_threads = cv->num_threads;
-	}
+	if (cv->num_threads > num_threads)
+		grow(cv->num_threads);
 
 	/* Element-wise maximum */
-	for (int i = 0;i < cv->num_threads;i++)
-		if (cv->clock[i] > clock[i]) {
-			clock[i] = cv->clock[i];
-			changed = true;
-		}
-
-	return changed;
+	return merge_max(clock, cv->clock, cv->num_threads);
 }
 
 /**
@@ -70,22 +201,11 @@ bool ClockVector::merge(const ClockVector *cv)
 bool ClockVector::minmerge(const ClockVector *cv)
 {
 	ASSERT(cv != NULL);
-	bool changed = false;
-	if (cv->num_threads > num_threads) {
-		clock = (modelclock_t *)snapshot_realloc(clock, cv->num_threads * sizeof(modelclock_t));
-		for (int i = num_threads;i < cv->num_threads;i++)
-			clock[i] = 0;
-		num_threads = cv->num_threads;
-	}
+	if (cv->num_threads > num_threads)
+		grow(cv->num_threads);
 
 	/* Element-wise minimum */
-	for (int i = 0;i < cv->num_threads;i++)
-		if (cv->clock[i] < clock[i]) {
-			clock[i] = cv->clock[i];
-			changed = true;
-		}
-
-	return changed;
+	return merge_min(clock, cv->clock, cv->num_threads);
 }
 
 /**
@@ -5,6 +5,7 @@
 #ifndef __CLOCKVECTOR_H__
 #define __CLOCKVECTOR_H__
 
+#include "config.h"
 #include "mymemory.h"
 #include "modeltypes.h"
 #include "classlist.h"
@@ -13,6 +14,9 @@ class ClockVector {
 public:
 	ClockVector(ClockVector *parent = NULL, const ModelAction *act = NULL);
 	~ClockVector();
+	/* clock may point into the object itself, so it must not be copied */
+	ClockVector(const ClockVector &) = delete;
+	ClockVector & operator=(const ClockVector &) = delete;
 	bool merge(const ClockVector *cv);
 	bool minmerge(const ClockVector *cv);
 	bool synchronized_since(const ModelAction *act) const;
@@ -20,13 +24,20 @@ public:
 	void print() const;
 	modelclock_t getClock(thread_id_t thread);
 
-	SNAPSHOTALLOC
+	SNAPSHOTPOOLALLOC
 private:
-	/** @brief Holds the actual clock data, as an array. */
+	void grow(int threads);
+
+	/** @brief Holds the actual clock data, as an array: inline_clock
+	 *  unless there are more threads than fit there. */
 	modelclock_t *clock;
 
 	/** @brief The number of threads recorded in clock (i.e., its length).  */
 	int num_threads;
+
+	modelclock_t inline_clock[CLOCKVECTOR_INLINE_THREADS];
 };
 
+void initClockVectors();
+
 #endif	/* __CLOCKVECTOR_H__ */
@@ -55,9 +55,8 @@ VOLATILELOAD(64)
 		model->switch_thread(new ModelAction(ATOMIC_WRITE, position, memory_order_volatile_store, obj, (uint64_t) val)); \
 		*((volatile uint ## size ## _t *)obj) = val;            \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                         \
-			atomraceCheckWrite(tid, (void *)(((char *)obj)+i));          \
-		}                                                       \
+		racesite = __builtin_return_address(0);        \
+		atomraceCheckWrite ## size(tid, obj);                   \
 	}
 
 VOLATILESTORE(8)
@@ -72,9 +71,8 @@ VOLATILESTORE(64)
 		model->switch_thread(new ModelAction(ATOMIC_INIT, position, memory_order_relaxed, obj, (uint64_t) val)); \
 		*((volatile uint ## size ## _t *)obj) = val;                                 \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                       \
-			atomraceCheckWrite(tid, (void *)(((char *)obj)+i));          \
-		}                                                       \
+		racesite = __builtin_return_address(0);        \
+		atomraceCheckWrite ## size(tid, obj);                   \
 	}
 
 CDSATOMICINT(8)
@@ -89,9 +87,8 @@ CDSATOMICINT(64)
 		uint ## size ## _t val = (uint ## size ## _t)model->switch_thread( \
 			new ModelAction(ATOMIC_READ, position, orders[atomic_index], obj)); \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                         \
-			atomraceCheckRead(tid, (void *)(((char *)obj)+i));    \
-		}                                                       \
+		racesite = __builtin_return_address(0);        \
+		atomraceCheckRead ## size(tid, obj);                    \
 		return val; \
 	}
 
@@ -107,9 +104,8 @@ CDSATOMICLOAD(64)
 		model->switch_thread(new ModelAction(ATOMIC_WRITE, position, orders[atomic_index], obj, (uint64_t) val)); \
 		*((volatile uint ## size ## _t *)obj) = val;                     \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                       \
-			atomraceCheckWrite(tid, (void *)(((char *)obj)+i));          \
-		}                                                       \
+		racesite = __builtin_return_address(0);        \
+		atomraceCheckWrite ## size(tid, obj);                   \
 	}
 
 CDSATOMICSTORE(8)
@@ -127,10 +123,9 @@ CDSATOMICSTORE(64)
 		model_rmw_action_helper(addr, (uint64_t) _copy, atomic_index, position);        \
 		*((volatile uint ## size ## _t *)addr) = _copy;                  \
 		thread_id_t tid = thread_current_id();           \
-		for(int i=0;i < size / 8;i++) {                       \
-			atomraceCheckRead(tid,  (void *)(((char *)addr)+i));  \
-			recordWrite(tid, (void *)(((char *)addr)+i));         \
-		}                                                       \
+		racesite = __builtin_return_address(0);        \
+		atomraceCheckRead ## size(tid, addr);                   \
+		recordWrite ## size(tid, addr);                         \
 		return _old;                                            \
 	})
 
@@ -213,9 +208,7 @@ CDSATOMICXOR(64)
 			model_rmw_action_helper(addr, (uint64_t) _desired, atomic_index, position); \
 			*((volatile uint ## size ## _t *)addr) = desired;                        \
 			thread_id_t tid = thread_current_id();           \
-			for(int i=0;i < size / 8;i++) {                       \
-				recordWrite(tid, (void *)(((char *)addr)+i));         \
-			}                                                       \
+			recordWrite ## size(tid, addr);                         \
 			return _expected; }                                     \
 		else {                                                                                        \
 			model_rmwc_action_helper(addr, atomic_index, position); _expected = _old; return _old; }              \
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include <model-assert.h>
 
@@ -98,6 +99,39 @@ void redirect_output()
 
 }
 
+/**
+ * @brief Give this execution its own output file, when it resumes from a
+ * snapshot taken after redirect_output()
+ *
+ * The new file starts with what the program printed before the snapshot, so
+ * that output is shown with every execution.
+ */
+void reopen_program_output()
+{
+	char buf[200];
+	int prefix_out = fd_user_out;
+
+	/* The prefix file stays open, but may share the name of the new file */
+	unlink(filename);
+	snprintf_(filename, sizeof(filename), "C11FuzzerTmp%d", getpid());
+	fd_user_out = open(filename, O_CREAT | O_TRUNC| O_RDWR, S_IRWXU);
+
+	ssize_t ret;
+	off_t offset = 0;
+	while ((ret = pread(prefix_out, buf, sizeof(buf), offset)) > 0) {
+		if (write(fd_user_out, buf, ret) != ret) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+		offset += ret;
+	}
+
+	if (dup2(fd_user_out, STDOUT_FILENO) < 0) {
+		perror("dup2");
+		exit(EXIT_FAILURE);
+	}
+}
+
 /**
  * @brief Wrapper for reading data to buffer
  *
@@ -165,3 +199,19 @@ void print_program_output()
 	model_print("---- END PROGRAM OUTPUT   ----\n");
 }
 #endif	/* ! CONFIG_DEBUG */
+
+/** Parses an unsigned int option value; returns false for a value that is
+ * not a whole number in the range of unsigned int, including a negative
+ * one. */
+bool parse_unsigned(const char *arg, unsigned int *value)
+{
+	if (*arg < '0' || *arg > '9')
+		return false;
+	char *end;
+	errno = 0;
+	unsigned long num = strtoul(arg, &end, 10);
+	if (errno != 0 || *end != '\0' || num > UINT_MAX)
+		return false;
+	*value = num;
+	return true;
+}
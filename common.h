@@ -54,4 +54,5 @@ void assert_hook(void);
 #define error_msg(...) fprintf(stderr, "Error: " __VA_ARGS__)
 
 void print_trace(void);
+bool parse_unsigned(const char *arg, unsigned int *value);
 #endif	/* __COMMON_H__ */
@@ -34,9 +34,16 @@
 /** Size of signal stack */
 #define SIGSTACKSIZE 65536
 
+/** Roll executions back in-process, by restoring the pages written since the
+ *  snapshot, instead of forking a new process for each execution. */
+//#define DIRTY_PAGE_SNAPSHOT
+
 /** Page size configuration */
 #define PAGESIZE 4096
 
+/** Size of a (transparent or explicit) huge page */
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+
 #define TLS 1
 
 /** Thread parameters */
@@ -44,9 +51,18 @@
 /* Size of stack to allocate for a thread. */
 #define STACK_SIZE (1024 * 1024)
 
+/** Use 64 bit race detector shadow cells instead of 128 bit ones.  They take
+ *  half the memory, but a location falls back to a heap-allocated record once
+ *  a thread id above 62 or a clock above 2^25 touches it. */
+//#define COMPACT_SHADOW_CELLS
+
 /** How many shadow tables of memory to preallocate for data race detector. */
 #define SHADOWBASETABLES 4
 
+/** Number of threads whose clocks a clock vector holds inline, without a
+ *  separately allocated array */
+#define CLOCKVECTOR_INLINE_THREADS 8
+
 /** Enable debugging assertions (via ASSERT()) */
 #define CONFIG_ASSERT
 
@@ -137,32 +137,26 @@ void CycleGraph::addRMWEdge(ModelAction *from, ModelAction *rmw)
 	addNodeEdge(fromnode, rmwnode, true);
 }
 
-void CycleGraph::addEdges(SnapList<ModelAction *> * edgeset, ModelAction *to) {
-	for(sllnode<ModelAction*> * it = edgeset->begin();it!=NULL;) {
-		ModelAction *act = it->getVal();
-		CycleNode *node = getNode(act);
-		sllnode<ModelAction*> * it2 = it;
-		it2=it2->getNext();
-		for(;it2!=NULL; ) {
-			ModelAction *act2 = it2->getVal();
-			CycleNode *node2 = getNode(act2);
+void CycleGraph::addEdges(SnapVector<ModelAction *> * edgeset, ModelAction *to) {
+	for(uint i = 0;i < edgeset->size();) {
+		CycleNode *node = getNode((*edgeset)[i]);
+		bool removed = false;
+		for(uint j = i + 1;j < edgeset->size();) {
+			CycleNode *node2 = getNode((*edgeset)[j]);
 			if (checkReachable(node, node2)) {
-				it = edgeset->erase(it);
-				goto endouterloop;
+				edgeset->removeAt(i);
+				removed = true;
+				break;
 			} else if (checkReachable(node2, node)) {
-				it2 = edgeset->erase(it2);
-				goto endinnerloop;
-			}
-			it2=it2->getNext();
-endinnerloop:
-			;
+				edgeset->removeAt(j);
+			} else
+				j++;
 		}
-		it=it->getNext();
-endouterloop:
-		;
+		if (!removed)
+			i++;
 	}
-	for(sllnode<ModelAction*> *it = edgeset->begin();it!=NULL;it=it->getNext()) {
-		ModelAction *from = it->getVal();
+	for(uint i = 0;i < edgeset->size();i++) {
+		ModelAction *from = (*edgeset)[i];
 		addEdge(from, to, from->get_tid() == to->get_tid());
 	}
 }
@@ -23,7 +23,7 @@ class CycleGraph {
 public:
 	CycleGraph();
 	~CycleGraph();
-	void addEdges(SnapList<ModelAction *> * edgeset, ModelAction *to);
+	void addEdges(SnapVector<ModelAction *> * edgeset, ModelAction *to);
 	void addEdge(ModelAction *from, ModelAction *to);
 	void addEdge(ModelAction *from, ModelAction *to, bool forceedge);
 	void addRMWEdge(ModelAction *from, ModelAction *rmw);
@@ -73,7 +73,7 @@ public:
 	void removeEdge(CycleNode *dst);
 	~CycleNode();
 
-	SNAPSHOTALLOC
+	SNAPSHOTPOOLALLOC
 private:
 	/** @brief The ModelAction that this node represents */
 	ModelAction *action;
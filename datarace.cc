@@ -10,36 +10,171 @@
 #include "execution.h"
 #include "stl-model.h"
 #include <execinfo.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "snapshot-interface.h"
+
+/* Linux 4.17; older kernels ignore the flag */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
 static struct ShadowTable *root;
 static void *memory_base;
 static void *memory_top;
 static RaceSet * raceset;
-
-#ifdef COLLECT_STAT
-static unsigned int store8_count = 0;
-static unsigned int store16_count = 0;
-static unsigned int store32_count = 0;
-static unsigned int store64_count = 0;
-
-static unsigned int load8_count = 0;
-static unsigned int load16_count = 0;
-static unsigned int load32_count = 0;
-static unsigned int load64_count = 0;
-#endif
+/* Split words released by resetShadowRange, by granule shift, linked
+ * through array[0] */
+static struct ShadowSplitWord *freesplitwords[SHADOWWORDSHIFT];
+/* Most recently built read vector, for sharing between locations */
+static struct ReadVector *lastReadVector;
+
+/* Direct-mapped shadow; flat_windowsize is 0 when it is not in use. */
+static uintptr_t flat_lowbase;
+static uintptr_t flat_highbase;
+static uintptr_t flat_windowsize;
+static shadowcell_t *flat_shadow;
+
+/* Recently used shadow base tables, per thread.  The cache is snapshotted
+ * along with the tables it points to, so a rollback reverts both together
+ * and it never refers to a table that no longer exists. */
+struct ShadowLookaside {
+	uintptr_t page[LOOKASIDEENTRIES];
+	struct ShadowBaseTable *table[LOOKASIDEENTRIES];
+};
+
+static struct ShadowLookaside lookaside[LOOKASIDETHREADS];
+
+/* Counters that outlive rollbacks, in non-snapshotted memory */
+static struct race_stats *racestats;
+
+/* Races already seen, by the program location of the racing access, the
+ * word, and the thread and kind of the earlier access.  The filter is kept
+ * across executions in non-snapshotted memory, so it holds nothing that a
+ * rollback invalidates, such as actions or clocks. */
+enum RaceFilterState {
+	/* Unwound once, to the stack with stackhash */
+	FILTERSEEN,
+	/* Unwound again to the same stack, a duplicate of a printed race:
+	 * dropped from now on */
+	FILTERCONFIRMED,
+	/* Unwound to different stacks, as from different callers: never
+	 * dropped */
+	FILTERMIXED
+};
+
+struct RaceFilterEntry {
+	uintptr_t word;
+	const void *site;
+	thread_id_t oldthread;
+	bool isoldwrite;
+	bool isnewwrite;
+	enum RaceFilterState state;
+	unsigned int stackhash;
+};
+
+static struct RaceFilterEntry *racefilter;
+const void *racesite;
+
+/* Symbolized stack frames, by PC, in non-snapshotted memory */
+static HashTable<void *, char *, uintptr_t, 4, model_malloc, model_calloc, model_free> * symbolcache;
+
+/* Sampling state of a word, kept across executions in non-snapshotted
+ * memory. */
+struct SampleSlot {
+	uintptr_t word;
+	/* Executions in which the word has been checked, without a race */
+	unsigned int cleanexecs;
+	/* Execution that countdown applies to */
+	int execution;
+	/* Accesses to skip before the next check */
+	unsigned int countdown;
+	bool racy;
+};
+
+/* Own-stack filter: the top of each thread's frames, from where it starts
+ * running the program, and whether a pointer into its stack was published.
+ * Snapshotted, so it follows the threads of the current execution. */
+struct ThreadStack {
+	uintptr_t top;
+	bool escaped;
+};
+
+static int stackfilter;
+static struct ThreadStack *threadstacks;
+static int numthreadstacks;
+
+/* Sampling mode; sampletable is NULL when every access is checked. */
+static struct SampleSlot *sampletable;
+static unsigned int samplethreshold;
+static unsigned int samplemaxperiod;
 
 static const ModelExecution * get_execution()
 {
 	return model->get_execution();
 }
 
+/**
+ * Reserves the direct-mapped shadow.  The low window starts a little below
+ * the program break, so it covers the program's data and heap; the high
+ * window ends just above the stack, so it covers the stacks and the memory
+ * mappings below them.  The shadow itself is placed between the windows,
+ * if that space is free; otherwise the table tree shadows everything.
+ */
+static void initFlatShadow()
+{
+	/* The in-process snapshots would have to scan the whole reservation */
+	if (snapshot_in_process())
+		return;
+
+	uintptr_t brk = (uintptr_t)sbrk(0);
+	uintptr_t lowbase = brk > (1ULL << 32) ? (brk - (1ULL << 32)) & ~(uintptr_t)(PAGESIZE - 1) : 0;
+	uintptr_t stack = (uintptr_t)&brk;
+	/* Leave room above for the rest of the stack, the environment and the vdso */
+	uintptr_t highend = (stack | ((1ULL << 32) - 1)) + 1 + (1ULL << 32);
+	if (highend < FLATSHADOWWINDOW || highend - FLATSHADOWWINDOW < lowbase + FLATSHADOWWINDOW + 2 * FLATSHADOWSIZE)
+		return;
+
+	/* Kernels that ignore MAP_FIXED_NOREPLACE take the address as a mere
+	 * hint, and may place the shadow elsewhere, even inside a window it
+	 * shadows; the table tree is used then. */
+	void *hint = (void *)(lowbase + FLATSHADOWWINDOW);
+	void *shadow = mmap(hint, 2 * FLATSHADOWSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+	if (shadow == MAP_FAILED)
+		return;
+	if (shadow != hint) {
+		munmap(shadow, 2 * FLATSHADOWSIZE);
+		return;
+	}
+
+	flat_shadow = (shadowcell_t *)shadow;
+	flat_lowbase = lowbase;
+	flat_highbase = highend - FLATSHADOWWINDOW;
+	flat_windowsize = FLATSHADOWWINDOW;
+}
+
 /** This function initialized the data race detector. */
 void initRaceDetector()
 {
+	initFlatShadow();
+	racestats = (struct race_stats *)model_calloc(1, sizeof(struct race_stats));
+	struct model_params *params = model->getParams();
+	stackfilter = params->stackfilter;
+	if (params->racesample != 0) {
+		sampletable = (struct SampleSlot *)model_calloc(SAMPLESLOTS, sizeof(struct SampleSlot));
+		samplethreshold = params->racesample;
+		samplemaxperiod = params->sampleperiod;
+	}
+	for(int i = 0;i < LOOKASIDETHREADS;i++)
+		for(int j = 0;j < LOOKASIDEENTRIES;j++)
+			lookaside[i].page[j] = UINTPTR_MAX;
 	root = (struct ShadowTable *)snapshot_calloc(sizeof(struct ShadowTable), 1);
 	memory_base = snapshot_calloc(sizeof(struct ShadowBaseTable) * SHADOWBASETABLES, 1);
 	memory_top = ((char *)memory_base) + sizeof(struct ShadowBaseTable) * SHADOWBASETABLES;
 	raceset = new RaceSet();
+	racefilter = (struct RaceFilterEntry *)model_calloc(RACEFILTERSLOTS, sizeof(struct RaceFilterEntry));
+	symbolcache = new HashTable<void *, char *, uintptr_t, 4, model_malloc, model_calloc, model_free>();
 }
 
 void * table_calloc(size_t size)
@@ -53,43 +188,210 @@ void * table_calloc(size_t size)
 	}
 }
 
-/** This function looks up the entry in the shadow table corresponding to a
- * given address.*/
-static inline uint64_t * lookupAddressEntry(const void *address)
+/** This function looks up the word-granular shadow cell for a given address
+ * in the shadow table tree. */
+static shadowcell_t * lookupTableEntry(thread_id_t thread, const void *address)
+{
+	uintptr_t page = ((uintptr_t)address) >> 16;
+	struct ShadowLookaside *cache = &lookaside[id_to_int(thread) & (LOOKASIDETHREADS - 1)];
+	unsigned int slot = page & (LOOKASIDEENTRIES - 1);
+	racestats->tablelookups++;
+	struct ShadowBaseTable *basetable;
+	if (cache->page[slot] == page) {
+		racestats->lookasidehits++;
+		basetable = cache->table[slot];
+	} else {
+		struct ShadowTable *currtable = root;
+#if BIT48
+		currtable = (struct ShadowTable *) currtable->array[(((uintptr_t)address) >> 32) & MASK16BIT];
+		if (currtable == NULL) {
+			currtable = (struct ShadowTable *)(root->array[(((uintptr_t)address) >> 32) & MASK16BIT] = table_calloc(sizeof(struct ShadowTable)));
+			racestats->tablesallocated++;
+		}
+#endif
+
+		basetable = (struct ShadowBaseTable *)currtable->array[(((uintptr_t)address) >> 16) & MASK16BIT];
+		if (basetable == NULL) {
+			basetable = (struct ShadowBaseTable *)(currtable->array[(((uintptr_t)address) >> 16) & MASK16BIT] = table_calloc(sizeof(struct ShadowBaseTable)));
+			racestats->tablesallocated++;
+		}
+		cache->page[slot] = page;
+		cache->table[slot] = basetable;
+	}
+	return &basetable->array[(((uintptr_t)address) & MASK16BIT) >> SHADOWWORDSHIFT];
+}
+
+/** This function looks up the word-granular shadow cell covering a given
+ * address.  The cell may have been split into per-byte cells. */
+static inline shadowcell_t * lookupWordEntry(thread_id_t thread, const void *address)
+{
+	uintptr_t offset = ((uintptr_t)address) - flat_lowbase;
+	if (offset < flat_windowsize)
+		return flat_shadow + (offset >> SHADOWWORDSHIFT);
+	offset = ((uintptr_t)address) - flat_highbase;
+	if (offset < flat_windowsize)
+		return flat_shadow + ((flat_windowsize + offset) >> SHADOWWORDSHIFT);
+	return lookupTableEntry(thread, address);
+}
+
+/** Finds the word cell for an address like lookupWordEntry, but returns
+ * NULL rather than creating a table that does not exist yet. */
+static shadowcell_t * peekWordEntry(const void *address)
 {
+	uintptr_t offset = ((uintptr_t)address) - flat_lowbase;
+	if (offset < flat_windowsize)
+		return flat_shadow + (offset >> SHADOWWORDSHIFT);
+	offset = ((uintptr_t)address) - flat_highbase;
+	if (offset < flat_windowsize)
+		return flat_shadow + ((flat_windowsize + offset) >> SHADOWWORDSHIFT);
+
 	struct ShadowTable *currtable = root;
 #if BIT48
 	currtable = (struct ShadowTable *) currtable->array[(((uintptr_t)address) >> 32) & MASK16BIT];
-	if (currtable == NULL) {
-		currtable = (struct ShadowTable *)(root->array[(((uintptr_t)address) >> 32) & MASK16BIT] = table_calloc(sizeof(struct ShadowTable)));
-	}
+	if (currtable == NULL)
+		return NULL;
 #endif
-
 	struct ShadowBaseTable *basetable = (struct ShadowBaseTable *)currtable->array[(((uintptr_t)address) >> 16) & MASK16BIT];
-	if (basetable == NULL) {
-		basetable = (struct ShadowBaseTable *)(currtable->array[(((uintptr_t)address) >> 16) & MASK16BIT] = table_calloc(sizeof(struct ShadowBaseTable)));
+	if (basetable == NULL)
+		return NULL;
+	return &basetable->array[(((uintptr_t)address) & MASK16BIT) >> SHADOWWORDSHIFT];
+}
+
+/** Makes an independent copy of a full record.  The read vector is shared. */
+static struct RaceRecord * copyRecord(struct RaceRecord *record)
+{
+	struct RaceRecord *copy = (struct RaceRecord *)snapshot_malloc(sizeof(struct RaceRecord));
+	*copy = *record;
+	if (record->readVector != NULL)
+		record->readVector->refcount++;
+	return copy;
+}
+
+/** Makes an independent copy of a granule cell, for a finer granule. */
+static shadowcell_t copyCell(shadowcell_t shadowval)
+{
+	if (shadowval == 0 || ISSHORTRECORD(shadowval))
+		return shadowval;
+	return ENCODEPTR(copyRecord(RECORD(shadowval)));
+}
+
+/** Gives a split word's cells back for reuse, cleared.  Any full records
+ * they point to must have been freed or handed on. */
+static void freeSplitWord(shadowcell_t wordval)
+{
+	int shift = SPLITSHIFT(wordval);
+	struct ShadowSplitWord *split = SPLITWORD(wordval);
+	memset(split->array, 0, sizeof(shadowcell_t) << (SHADOWWORDSHIFT - shift));
+	split->array[0] = ENCODEPTR(freesplitwords[shift]);
+	freesplitwords[shift] = split;
+}
+
+/**
+ * Splits a word cell, or the cells of a word already split into larger
+ * granules, into cells for granules of 2^shift bytes.  Each new cell starts
+ * out with the state of the cell it is carved from.  A word that has not
+ * been accessed yet is only given cells for the size of its first access,
+ * so a word accessed by one size of access never ends up with byte cells.
+ */
+static shadowcell_t splitWordEntry(shadowcell_t *word, int shift)
+{
+	shadowcell_t wordval = *word;
+	struct ShadowSplitWord *split = freesplitwords[shift];
+	if (split != NULL) {
+		freesplitwords[shift] = (struct ShadowSplitWord *)(uintptr_t)split->array[0];
+		split->array[0] = 0;
+	} else
+		split = (struct ShadowSplitWord *)table_calloc(sizeof(shadowcell_t) << (SHADOWWORDSHIFT - shift));
+
+	int oldshift = SHADOWWORDSHIFT;
+	shadowcell_t *old = word;
+	if (ISSPLITWORD(wordval)) {
+		oldshift = SPLITSHIFT(wordval);
+		old = SPLITWORD(wordval)->array;
+	}
+	if (wordval == 0) {
+		racestats->lanewords++;
+	} else {
+		racestats->splitwords++;
+		int ratio = oldshift - shift;
+		for(int i = 0;i < (SHADOWWORDSIZE >> shift);i++)
+			split->array[i] = (i & ((1 << ratio) - 1)) == 0 ? old[i >> ratio] : copyCell(old[i >> ratio]);
+		if (ISSPLITWORD(wordval))
+			freeSplitWord(wordval);
 	}
-	return &basetable->array[((uintptr_t)address) & MASK16BIT];
+	*word = ENCODESPLIT(split, shift);
+	return *word;
+}
+
+/** Returns the log2 of the largest granule, smaller than a word, that an
+ * access of len bytes at address covers a whole number of. */
+static inline int accessShift(const void *address, unsigned int len)
+{
+	return __builtin_ctz((((uintptr_t)address) & SHADOWWORDMASK) | len | (SHADOWWORDSIZE / 2));
+}
+
+/**
+ * Looks up the cells for an access of len bytes at address, which lie in a
+ * single word.  The word is split, if it is not yet split into granules no
+ * larger than the access, and *shift is set to the log2 of the granule
+ * size; the access covers the (len >> *shift) cells from the result on.
+ */
+static inline shadowcell_t * lookupGranuleEntry(thread_id_t thread, const void *address, unsigned int len, int *shift)
+{
+	shadowcell_t *word = lookupWordEntry(thread, address);
+	shadowcell_t wordval = *word;
+	int needed = accessShift(address, len);
+	if (!ISSPLITWORD(wordval) || SPLITSHIFT(wordval) > needed)
+		wordval = splitWordEntry(word, needed);
+	*shift = SPLITSHIFT(wordval);
+	return &SPLITWORD(wordval)->array[(((uintptr_t)address) & SHADOWWORDMASK) >> *shift];
+}
+
+/** This function looks up the byte-granular shadow cell for a given
+ * address, splitting the enclosing word if necessary.*/
+static inline shadowcell_t * lookupAddressEntry(thread_id_t thread, const void *address)
+{
+	int shift;
+	return lookupGranuleEntry(thread, address, 1, &shift);
+}
+
+/** This function looks up a shadow cell describing the byte at a given
+ * address without splitting: either the cell of its granule or the cell of
+ * its unsplit word. */
+static inline shadowcell_t * peekAddressEntry(thread_id_t thread, const void *address)
+{
+	shadowcell_t *word = lookupWordEntry(thread, address);
+	shadowcell_t wordval = *word;
+	if (ISSPLITWORD(wordval))
+		return &SPLITWORD(wordval)->array[(((uintptr_t)address) & SHADOWWORDMASK) >> SPLITSHIFT(wordval)];
+	return word;
 }
 
 
+/* Queries made by the model checker itself share the lookaside cache of the
+ * first thread. */
+#define LOOKASIDESHARED int_to_id(0)
+
 bool hasNonAtomicStore(const void *address) {
-	uint64_t * shadow = lookupAddressEntry(address);
-	uint64_t shadowval = *shadow;
+	shadowcell_t * shadow = peekAddressEntry(LOOKASIDESHARED, address);
+	shadowcell_t shadowval = *shadow;
 	if (ISSHORTRECORD(shadowval)) {
 		//Do we have a non atomic write with a non-zero clock
 		return !(ATOMICMASK & shadowval);
 	} else {
 		if (shadowval == 0)
 			return true;
-		struct RaceRecord *record = (struct RaceRecord *)shadowval;
+		struct RaceRecord *record = RECORD(shadowval);
 		return !record->isAtomic;
 	}
 }
 
+/** Marks the last store to an address as atomic, on the cell that covers
+ * it: an atomic's word is not split just because it was first written by a
+ * plain store. */
 void setAtomicStoreFlag(const void *address) {
-	uint64_t * shadow = lookupAddressEntry(address);
-	uint64_t shadowval = *shadow;
+	shadowcell_t * shadow = peekAddressEntry(LOOKASIDESHARED, address);
+	shadowcell_t shadowval = *shadow;
 	if (ISSHORTRECORD(shadowval)) {
 		*shadow = shadowval | ATOMICMASK;
 	} else {
@@ -97,20 +399,20 @@ void setAtomicStoreFlag(const void *address) {
 			*shadow = ATOMICMASK | ENCODEOP(0, 0, 0, 0);
 			return;
 		}
-		struct RaceRecord *record = (struct RaceRecord *)shadowval;
+		struct RaceRecord *record = RECORD(shadowval);
 		record->isAtomic = 1;
 	}
 }
 
 void getStoreThreadAndClock(const void *address, thread_id_t * thread, modelclock_t * clock) {
-	uint64_t * shadow = lookupAddressEntry(address);
-	uint64_t shadowval = *shadow;
+	shadowcell_t * shadow = peekAddressEntry(LOOKASIDESHARED, address);
+	shadowcell_t shadowval = *shadow;
 	if (ISSHORTRECORD(shadowval) || shadowval == 0) {
 		//Do we have a non atomic write with a non-zero clock
 		*thread = WRTHREADID(shadowval);
 		*clock = WRITEVECTOR(shadowval);
 	} else {
-		struct RaceRecord *record = (struct RaceRecord *)shadowval;
+		struct RaceRecord *record = RECORD(shadowval);
 		*thread = record->writeThread;
 		*clock = record->writeClock;
 	}
@@ -135,9 +437,10 @@ static bool clock_may_race(ClockVector *clock1, thread_id_t tid1,
  * Expands a record from the compact form to the full form.  This is
  * necessary for multiple readers or for very large thread ids or time
  * stamps. */
-static void expandRecord(uint64_t *shadow)
+static void expandRecord(shadowcell_t *shadow)
 {
-	uint64_t shadowval = *shadow;
+	shadowcell_t shadowval = *shadow;
+	racestats->expandedrecords++;
 
 	modelclock_t readClock = READVECTOR(shadowval);
 	thread_id_t readThread = int_to_id(RDTHREADID(shadowval));
@@ -148,26 +451,128 @@ static void expandRecord(uint64_t *shadow)
 	record->writeThread = writeThread;
 	record->writeClock = writeClock;
 
-	if (readClock != 0) {
-		record->thread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * INITCAPACITY);
-		record->readClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * INITCAPACITY);
-		record->numReads = 1;
-		ASSERT(readThread >= 0);
-		record->thread[0] = readThread;
-		record->readClock[0] = readClock;
-	} else {
-		record->thread = NULL;
-	}
+	record->readThread = readThread;
+	record->readClock = readClock;
 	if (shadowval & ATOMICMASK)
 		record->isAtomic = 1;
-	*shadow = (uint64_t) record;
+	*shadow = ENCODEPTR(record);
+}
+
+/** Drops a reference to a read vector. */
+static void releaseReadVector(struct ReadVector *vector)
+{
+	if (--vector->refcount == 0)
+		snapshot_free(vector);
+}
+
+/** Forgets the reads of a record, after a write. */
+static void clearReads(struct RaceRecord *record)
+{
+	if (record->readVector != NULL) {
+		releaseReadVector(record->readVector);
+		record->readVector = NULL;
+	}
+	record->readClock = 0;
+}
+
+/**
+ * Switches a record to, or updates, a read vector with the given thread's
+ * clock.  An unshared vector is updated in place.  Otherwise the new
+ * contents are compared with the most recently built vector, which is
+ * shared if it matches: neighbouring locations that are read by the same
+ * threads in the same epochs then use a single vector.
+ */
+static void setReadVectorClock(struct RaceRecord *record, int tid, modelclock_t clock)
+{
+	struct ReadVector *old = record->readVector;
+	if (old != NULL && old == lastReadVector && old->refcount == 2) {
+		/* Only shared with the cache; take it back */
+		lastReadVector = NULL;
+		old->refcount--;
+	}
+	if (old != NULL && old->refcount == 1 && tid < old->size) {
+		old->clock[tid] = clock;
+		return;
+	}
+
+	int size = get_execution()->get_num_threads();
+	if (old != NULL && old->size > size)
+		size = old->size;
+	if (tid >= size)
+		size = tid + 1;
+	int epochtid = id_to_int(record->readThread);
+	if (old == NULL && epochtid >= size)
+		size = epochtid + 1;
+
+	struct ReadVector *vector = (struct ReadVector *)snapshot_calloc(1, sizeof(struct ReadVector) + size * sizeof(modelclock_t));
+	vector->refcount = 1;
+	vector->size = size;
+	if (old != NULL) {
+		std::memcpy(vector->clock, old->clock, old->size * sizeof(modelclock_t));
+		releaseReadVector(old);
+	} else {
+		vector->clock[epochtid] = record->readClock;
+	}
+	vector->clock[tid] = clock;
+
+	if (lastReadVector != NULL && lastReadVector->size == size &&
+			std::memcmp(lastReadVector->clock, vector->clock, size * sizeof(modelclock_t)) == 0) {
+		snapshot_free(vector);
+		vector = lastReadVector;
+	} else {
+		if (lastReadVector != NULL)
+			releaseReadVector(lastReadVector);
+		lastReadVector = vector;
+	}
+	vector->refcount++;
+	record->readVector = vector;
+}
+
+/**
+ * Records a read in a full record.  Reads that are ordered after the
+ * previous read only keep an epoch; a concurrent read switches the record
+ * to a read vector with one clock per thread.  Either way this is O(1)
+ * amortized.
+ */
+static void addRead(struct RaceRecord *record, thread_id_t thread, modelclock_t ourClock, ClockVector *currClock)
+{
+	struct ReadVector *vector = record->readVector;
+	int tid = id_to_int(thread);
+	if (vector == NULL) {
+		if (!clock_may_race(currClock, thread, record->readClock, record->readThread)) {
+			record->readThread = thread;
+			record->readClock = ourClock;
+			return;
+		}
+	} else if (tid < vector->size && vector->clock[tid] == ourClock) {
+		return;
+	}
+	setReadVectorClock(record, tid, ourClock);
+}
+
+/** Checks a write against the reads of a full record.  Returns the racing
+ * read's thread and clock, or a clock of 0. */
+static modelclock_t findRacingRead(struct RaceRecord *record, thread_id_t thread, ClockVector *currClock, thread_id_t *readThread)
+{
+	struct ReadVector *vector = record->readVector;
+	if (vector == NULL) {
+		*readThread = record->readThread;
+		return clock_may_race(currClock, thread, record->readClock, record->readThread) ? record->readClock : 0;
+	}
+	for (int i = 0;i < vector->size;i++) {
+		if (clock_may_race(currClock, thread, vector->clock[i], int_to_id(i))) {
+			*readThread = int_to_id(i);
+			return vector->clock[i];
+		}
+	}
+	return 0;
 }
 
 #define FIRST_STACK_FRAME 2
 
 unsigned int race_hash(struct DataRace *race) {
 	unsigned int hash = 0;
-	for(int i=FIRST_STACK_FRAME;i < race->numframes;i++) {
+	for(int i=race->firstframe;i < race->numframes;i++) {
 		hash ^= ((uintptr_t)race->backtrace[i]);
 		hash = (hash >> 3) | (hash << 29);
 	}
@@ -175,18 +580,225 @@ unsigned int race_hash(struct DataRace *race) {
 }
 
 bool race_equals(struct DataRace *r1, struct DataRace *r2) {
-	if (r1->numframes != r2->numframes)
+	if (r1->numframes - r1->firstframe != r2->numframes - r2->firstframe)
 		return false;
-	for(int i=FIRST_STACK_FRAME;i < r1->numframes;i++) {
-		if (r1->backtrace[i] != r2->backtrace[i])
+	for(int i=r1->firstframe, j=r2->firstframe;i < r1->numframes;i++, j++) {
+		if (r1->backtrace[i] != r2->backtrace[j])
 			return false;
 	}
 	return true;
 }
 
+#ifdef REPORT_DATA_RACES
+/**
+ * Records the stack of a race.  Hashing and comparison start at the first
+ * frame outside of the model checker, since how many of its own frames
+ * are on the stack depends on the entry point and on inlining.
+ */
+static void captureBacktrace(struct DataRace *race)
+{
+	race->numframes = backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
+	race->firstframe = FIRST_STACK_FRAME;
+
+	Dl_info self;
+	if (!dladdr((void *)&captureBacktrace, &self))
+		return;
+	for(int i = 0;i < race->numframes;i++) {
+		Dl_info info;
+		if (!dladdr(race->backtrace[i], &info) || info.dli_fbase != self.dli_fbase) {
+			race->firstframe = i;
+			return;
+		}
+	}
+}
+#endif
+
+/** Records where a thread's frames start, for the own-stack filter. */
+void setThreadStackTop(thread_id_t thread, const void *top)
+{
+	if (stackfilter == 0)
+		return;
+	int tid = id_to_int(thread);
+	if (tid >= numthreadstacks) {
+		int newsize = tid < 8 ? 8 : 2 * tid;
+		threadstacks = (struct ThreadStack *)snapshot_realloc(threadstacks, newsize * sizeof(struct ThreadStack));
+		memset(&threadstacks[numthreadstacks], 0, (newsize - numthreadstacks) * sizeof(struct ThreadStack));
+		numthreadstacks = newsize;
+	}
+	threadstacks[tid].top = (uintptr_t)top;
+	threadstacks[tid].escaped = false;
+}
+
+/**
+ * Is an access by the running thread to its own live stack frames, and to be
+ * left unchecked?  The frames lie between this function's frame and the top
+ * recorded when the thread started.
+ */
+static inline bool isOwnStackAccess(thread_id_t thread, const void *location)
+{
+	int tid = id_to_int(thread);
+	if (tid >= numthreadstacks)
+		return false;
+	struct ThreadStack *stack = &threadstacks[tid];
+	uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+	uintptr_t addr = (uintptr_t)location;
+	if (addr < sp || addr >= stack->top || stack->escaped)
+		return false;
+	racestats->stackskips++;
+	return true;
+}
+
+/** Is a range accessed by the running thread wholly in its own live stack
+ * frames, and to be left unchecked?  See isOwnStackAccess. */
+static inline bool isOwnStackRange(thread_id_t thread, const void *location, size_t size)
+{
+	int tid = id_to_int(thread);
+	if (tid >= numthreadstacks)
+		return false;
+	struct ThreadStack *stack = &threadstacks[tid];
+	uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+	uintptr_t addr = (uintptr_t)location;
+	if (addr < sp || addr + size > stack->top || addr + size < addr || stack->escaped)
+		return false;
+	racestats->stackskips++;
+	return true;
+}
+
+/** Stops filtering a thread's stack once a value that points into it is
+ * published, so that its accesses to the escaped object stay checked. */
+void noteStackEscape(thread_id_t thread, uint64_t value)
+{
+	if (stackfilter != 1)
+		return;
+	int tid = id_to_int(thread);
+	if (tid >= numthreadstacks)
+		return;
+	uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+	if (value >= sp && value < threadstacks[tid].top)
+		threadstacks[tid].escaped = true;
+}
+
+/**
+ * Decides whether the sampling mode skips the race check of a non-atomic
+ * access.  A word is checked on every access until it has been checked
+ * race-free in samplethreshold executions.  After that, only one access in
+ * 2^k is checked, where k counts the further race-free executions, until
+ * the rate reaches one in samplemaxperiod.  The first access of each
+ * execution is always checked.  Skipped writes leave an older epoch in the
+ * shadow, which can hide races but never invents one.
+ */
+static inline bool sampleSkip(const void *location)
+{
+	if (sampletable == NULL)
+		return false;
+	uintptr_t word = ((uintptr_t)location) >> SHADOWWORDSHIFT;
+	struct SampleSlot *slot = &sampletable[word & (SAMPLESLOTS - 1)];
+	int execution = model->get_execution_number();
+	if (slot->word != word) {
+		/* New word, or a collision: the word starts cold again. */
+		slot->word = word;
+		slot->cleanexecs = 0;
+		slot->execution = execution;
+		slot->countdown = 0;
+		slot->racy = false;
+		return false;
+	}
+	if (slot->execution != execution) {
+		slot->execution = execution;
+		slot->countdown = 0;
+		slot->cleanexecs++;
+	}
+	if (slot->racy || slot->cleanexecs < samplethreshold)
+		return false;
+	if (slot->countdown != 0) {
+		slot->countdown--;
+		racestats->skippedchecks++;
+		return true;
+	}
+	unsigned int shift = slot->cleanexecs - samplethreshold + 1;
+	unsigned int period = shift < 31 ? 1U << shift : samplemaxperiod;
+	slot->countdown = (period < samplemaxperiod ? period : samplemaxperiod) - 1;
+	return false;
+}
+
+/** Keeps a word that had a race fully checked in the sampling mode. */
+static void sampleRaceFound(const void *location)
+{
+	uintptr_t word = ((uintptr_t)location) >> SHADOWWORDSHIFT;
+	struct SampleSlot *slot = &sampletable[word & (SAMPLESLOTS - 1)];
+	slot->word = word;
+	slot->racy = true;
+}
+
+/** Finds the filter slot of a race, and whether it holds that race. */
+static struct RaceFilterEntry * raceFilterEntry(thread_id_t oldthread, bool isoldwrite, bool isnewwrite, const void *address, bool *match)
+{
+	uintptr_t word = ((uintptr_t)address) >> SHADOWWORDSHIFT;
+	unsigned int hash = (unsigned int)(word ^ (((uintptr_t)racesite) >> 2) ^ (((uintptr_t)racesite) >> 12) ^ id_to_int(oldthread));
+	struct RaceFilterEntry *entry = &racefilter[hash & (RACEFILTERSLOTS - 1)];
+	*match = entry->word == word && entry->site == racesite && entry->oldthread == oldthread &&
+					 entry->isoldwrite == isoldwrite && entry->isnewwrite == isnewwrite;
+	return entry;
+}
+
+/**
+ * Checks whether a race is a known repeat, in this or an earlier execution.
+ * A race in a loop, or in every execution, repeats at the same program
+ * location on the same word, against the same thread; once the race set
+ * has shown such a repeat to have the stack of a printed race, its further
+ * repeats are dropped here, before anything is allocated or the stack is
+ * unwound.  See raceFilterUpdate.
+ */
+static bool raceFiltered(thread_id_t oldthread, bool isoldwrite, bool isnewwrite, const void *address)
+{
+	if (racesite == NULL)
+		return false;
+	bool match;
+	struct RaceFilterEntry *entry = raceFilterEntry(oldthread, isoldwrite, isnewwrite, address, &match);
+	if (match && entry->state == FILTERCONFIRMED) {
+		racestats->filteredraces++;
+		return true;
+	}
+	return false;
+}
+
+#ifdef REPORT_DATA_RACES
+/**
+ * Tells the filter the stack a race was unwound to, and whether the race
+ * set found it a duplicate.  A race is only dropped by the filter once it
+ * was unwound to the same stack twice, and a race that was unwound to two
+ * different stacks, say through two callers of a helper, is never dropped.
+ */
+static void raceFilterUpdate(struct DataRace *race, unsigned int stackhash, bool duplicate)
+{
+	if (racesite == NULL)
+		return;
+	bool match;
+	struct RaceFilterEntry *entry = raceFilterEntry(race->oldthread, race->isoldwrite, race->isnewwrite, race->address, &match);
+	if (!match) {
+		entry->word = ((uintptr_t)race->address) >> SHADOWWORDSHIFT;
+		entry->site = racesite;
+		entry->oldthread = race->oldthread;
+		entry->isoldwrite = race->isoldwrite;
+		entry->isnewwrite = race->isnewwrite;
+		entry->state = FILTERSEEN;
+		entry->stackhash = stackhash;
+	} else if (entry->state == FILTERSEEN) {
+		if (stackhash != entry->stackhash)
+			entry->state = FILTERMIXED;
+		else if (duplicate)
+			entry->state = FILTERCONFIRMED;
+	}
+}
+#endif
+
 /** This function is called when we detect a data race.*/
 static struct DataRace * reportDataRace(thread_id_t oldthread, modelclock_t oldclock, bool isoldwrite, ModelAction *newaction, bool isnewwrite, const void *address)
 {
+	if (sampletable != NULL)
+		sampleRaceFound(address);
+	if (raceFiltered(oldthread, isoldwrite, isnewwrite, address))
+		return NULL;
 #ifdef REPORT_DATA_RACES
 	struct DataRace *race = (struct DataRace *)model_malloc(sizeof(struct DataRace));
 	race->oldthread = oldthread;
@@ -201,6 +813,33 @@ static struct DataRace * reportDataRace(thread_id_t oldthread, modelclock_t oldc
 #endif
 }
 
+/**
+ * Returns the printable name of a stack frame, in the format of
+ * backtrace_symbols_fd, which printed these frames before.  Names are
+ * resolved on first use and cached.
+ */
+static const char * symbolizeFrame(void *pc)
+{
+	char *name = symbolcache->get(pc);
+	if (name != NULL)
+		return name;
+
+	char buf[512];
+	Dl_info info;
+	if (!dladdr(pc, &info) || info.dli_fname == NULL)
+		snprintf(buf, sizeof(buf), "[%p]", pc);
+	else if (info.dli_sname != NULL)
+		snprintf(buf, sizeof(buf), "%s(%s+0x%lx)[%p]", info.dli_fname, info.dli_sname,
+						 (unsigned long)((uintptr_t)pc - (uintptr_t)info.dli_saddr), pc);
+	else
+		snprintf(buf, sizeof(buf), "%s(+0x%lx)[%p]", info.dli_fname,
+						 (unsigned long)((uintptr_t)pc - (uintptr_t)info.dli_fbase), pc);
+	name = (char *)model_malloc(strlen(buf) + 1);
+	strcpy(name, buf);
+	symbolcache->put(pc, name);
+	return name;
+}
+
 /**
  * @brief Assert a data race
  *
@@ -211,8 +850,10 @@ static struct DataRace * reportDataRace(thread_id_t oldthread, modelclock_t oldc
  */
 void assert_race(struct DataRace *race)
 {
+	racestats->reportedraces++;
 	model_print("Race detected at location: \n");
-	backtrace_symbols_fd(race->backtrace, race->numframes, model_out);
+	for(int i = 0;i < race->numframes;i++)
+		model_print("%s\n", symbolizeFrame(race->backtrace[i]));
 	model_print("\nData race detected @ address %p:\n"
 							"    Access 1: %5s in thread %2d @ clock %3u\n"
 							"    Access 2: %5s in thread %2d @ clock %3u\n\n",
@@ -226,22 +867,41 @@ void assert_race(struct DataRace *race)
 							);
 }
 
+#ifdef REPORT_DATA_RACES
+/**
+ * Reports a race unless it was reported before, by this process or, in a
+ * parallel run, by another worker.
+ */
+static void reportRace(struct DataRace *race)
+{
+	unsigned int stackhash = race_hash(race);
+	if (!raceset->add(race)) {
+		racestats->duplicateraces++;
+		raceFilterUpdate(race, stackhash, true);
+		model_free(race);
+	} else if (snapshot_merge_race(race)) {
+		raceFilterUpdate(race, stackhash, false);
+		assert_race(race);
+	} else {
+		/* Stays in raceset, so its repeats stop at the lookup above */
+		racestats->duplicateraces++;
+		raceFilterUpdate(race, stackhash, true);
+	}
+}
+#endif
+
 /** This function does race detection for a write on an expanded record. */
-struct DataRace * fullRaceCheckWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+struct DataRace * fullRaceCheckWrite(thread_id_t thread, const void *location, shadowcell_t *shadow, ClockVector *currClock)
 {
-	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
+	racestats->fullchecks++;
+	struct RaceRecord *record = RECORD(*shadow);
 	struct DataRace * race = NULL;
 
 	/* Check for datarace against last read. */
-
-	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
-
-		/* Note that readClock can't actuall be zero here, so it could be
-		         optimized. */
-
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
+	{
+		thread_id_t readThread;
+		modelclock_t readClock = findRacingRead(record, thread, currClock, &readThread);
+		if (readClock != 0) {
 			/* We have a datarace */
 			race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
 			goto Exit;
@@ -260,7 +920,7 @@ struct DataRace * fullRaceCheckWrite(thread_id_t thread, const void *location, u
 		}
 	}
 Exit:
-	record->numReads = 0;
+	clearReads(record);
 	record->writeThread = thread;
 	record->isAtomic = 0;
 	modelclock_t ourClock = currClock->getClock(thread);
@@ -271,8 +931,12 @@ Exit:
 /** This function does race detection on a write. */
 void raceCheckWrite(thread_id_t thread, void *location)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	shadowcell_t *shadow = lookupAddressEntry(thread, location);
+	shadowcell_t shadowval = *shadow;
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
 		return;
@@ -294,6 +958,7 @@ void raceCheckWrite(thread_id_t thread, void *location)
 			race = fullRaceCheckWrite(thread, location, shadow, currClock);
 			goto Exit;
 		}
+		racestats->shortchecks++;
 
 		{
 			/* Check for datarace against last read. */
@@ -326,10 +991,8 @@ ShadowExit:
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
@@ -337,24 +1000,19 @@ Exit:
 }
 
 /** This function does race detection for a write on an expanded record. */
-struct DataRace * atomfullRaceCheckWrite(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+struct DataRace * atomfullRaceCheckWrite(thread_id_t thread, const void *location, shadowcell_t *shadow, ClockVector *currClock)
 {
-	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
+	struct RaceRecord *record = RECORD(*shadow);
 	struct DataRace * race = NULL;
 
 	if (record->isAtomic)
 		goto Exit;
 
 	/* Check for datarace against last read. */
-
-	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
-
-		/* Note that readClock can't actuall be zero here, so it could be
-		         optimized. */
-
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
+	{
+		thread_id_t readThread;
+		modelclock_t readClock = findRacingRead(record, thread, currClock, &readThread);
+		if (readClock != 0) {
 			/* We have a datarace */
 			race = reportDataRace(readThread, readClock, false, get_execution()->get_parent_action(thread), true, location);
 			goto Exit;
@@ -374,7 +1032,7 @@ struct DataRace * atomfullRaceCheckWrite(thread_id_t thread, const void *locatio
 		}
 	}
 Exit:
-	record->numReads = 0;
+	clearReads(record);
 	record->writeThread = thread;
 	record->isAtomic = 1;
 	modelclock_t ourClock = currClock->getClock(thread);
@@ -383,10 +1041,9 @@ Exit:
 }
 
 /** This function does race detection on a write. */
-void atomraceCheckWrite(thread_id_t thread, void *location)
+static inline void atomraceCheckWrite_shadow(thread_id_t thread, const void *location, shadowcell_t *shadow)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
+	shadowcell_t shadowval = *shadow;
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
 		return;
@@ -444,20 +1101,23 @@ ShadowExit:
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
 	}
 }
 
+void atomraceCheckWrite(thread_id_t thread, void *location)
+{
+	atomraceCheckWrite_shadow(thread, location, lookupAddressEntry(thread, location));
+}
+
 /** This function does race detection for a write on an expanded record. */
-void fullRecordWrite(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock) {
-	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
-	record->numReads = 0;
+void fullRecordWrite(thread_id_t thread, void *location, shadowcell_t *shadow, ClockVector *currClock) {
+	struct RaceRecord *record = RECORD(*shadow);
+	clearReads(record);
 	record->writeThread = thread;
 	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
@@ -465,9 +1125,9 @@ void fullRecordWrite(thread_id_t thread, void *location, uint64_t *shadow, Clock
 }
 
 /** This function does race detection for a write on an expanded record. */
-void fullRecordWriteNonAtomic(thread_id_t thread, void *location, uint64_t *shadow, ClockVector *currClock) {
-	struct RaceRecord *record = (struct RaceRecord *)(*shadow);
-	record->numReads = 0;
+void fullRecordWriteNonAtomic(thread_id_t thread, void *location, shadowcell_t *shadow, ClockVector *currClock) {
+	struct RaceRecord *record = RECORD(*shadow);
+	clearReads(record);
 	record->writeThread = thread;
 	modelclock_t ourClock = currClock->getClock(thread);
 	record->writeClock = ourClock;
@@ -475,13 +1135,13 @@ void fullRecordWriteNonAtomic(thread_id_t thread, void *location, uint64_t *shad
 }
 
 /** This function just updates metadata on atomic write. */
-void recordWrite(thread_id_t thread, void *location) {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
+static inline void recordWrite_shadow(thread_id_t thread, const void *location, shadowcell_t *shadow)
+{
+	shadowcell_t shadowval = *shadow;
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	/* Do full record */
 	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-		fullRecordWrite(thread, location, shadow, currClock);
+		fullRecordWrite(thread, (void *)location, shadow, currClock);
 		return;
 	}
 
@@ -491,45 +1151,199 @@ void recordWrite(thread_id_t thread, void *location) {
 	/* Thread ID is too large or clock is too large. */
 	if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
 		expandRecord(shadow);
-		fullRecordWrite(thread, location, shadow, currClock);
+		fullRecordWrite(thread, (void *)location, shadow, currClock);
 		return;
 	}
 
 	*shadow = ENCODEOP(0, 0, threadid, ourClock) | ATOMICMASK;
 }
 
+void recordWrite(thread_id_t thread, void *location)
+{
+	recordWrite_shadow(thread, location, lookupAddressEntry(thread, location));
+}
+
 /** This function just updates metadata on atomic write. */
+/** Records a non-atomic write to one shadow cell, without checking it. */
+static inline void recordCallocCell(thread_id_t thread, const void *location, shadowcell_t *shadow, ClockVector *currClock, shadowcell_t newval)
+{
+	shadowcell_t shadowval = *shadow;
+	if (newval != INVALIDSHADOWVAL && (shadowval == 0 || ISSHORTRECORD(shadowval))) {
+		*shadow = newval;
+		return;
+	}
+	/* Thread ID or clock is too large, or the cell already has a full record. */
+	if (shadowval == 0 || ISSHORTRECORD(shadowval))
+		expandRecord(shadow);
+	fullRecordWriteNonAtomic(thread, (void *)location, shadow, currClock);
+}
+
+/** This function records the zeroing of a calloc'd range as a non-atomic
+ * write, a span of contiguous word cells at a time. */
 void recordCalloc(void *location, size_t size) {
 	thread_id_t thread = thread_current_id();
-	for(;size != 0;size--) {
-		uint64_t *shadow = lookupAddressEntry(location);
-		uint64_t shadowval = *shadow;
-		ClockVector *currClock = get_execution()->get_cv(thread);
-		/* Do full record */
-		if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
-			fullRecordWriteNonAtomic(thread, location, shadow, currClock);
-			return;
+	ClockVector *currClock = get_execution()->get_cv(thread);
+	int threadid = id_to_int(thread);
+	modelclock_t ourClock = currClock->getClock(thread);
+	shadowcell_t newval = INVALIDSHADOWVAL;
+	if (threadid <= MAXTHREADID && ourClock <= MAXWRITEVECTOR)
+		newval = ENCODEOP(0, 0, threadid, ourClock);
+
+	uintptr_t addr = (uintptr_t)location;
+	uintptr_t end = addr + size;
+	while (addr < end) {
+		if (ISWORDALIGNED(addr) && end - addr >= SHADOWWORDSIZE) {
+			uintptr_t spanend = SHADOWSPANEND(addr, end);
+			shadowcell_t *cells = lookupWordEntry(thread, (const void *)addr);
+			for(;addr < spanend;addr += SHADOWWORDSIZE, cells++) {
+				if (ISSPLITWORD(*cells)) {
+					shadowcell_t *granules = SPLITWORD(*cells)->array;
+					int shift = SPLITSHIFT(*cells);
+					for(int i = 0;i < (SHADOWWORDSIZE >> shift);i++)
+						recordCallocCell(thread, (const void *)(addr + (i << shift)), &granules[i], currClock, newval);
+				} else
+					recordCallocCell(thread, (const void *)addr, cells, currClock, newval);
+			}
+			continue;
 		}
+		uintptr_t wordend = (addr | SHADOWWORDMASK) + 1;
+		if (wordend > end)
+			wordend = end;
+		int shift;
+		shadowcell_t *granules = lookupGranuleEntry(thread, (const void *)addr, wordend - addr, &shift);
+		for(int i = 0;addr < wordend;i++, addr += 1 << shift)
+			recordCallocCell(thread, (const void *)addr, &granules[i], currClock, newval);
+	}
+}
 
-		int threadid = id_to_int(thread);
-		modelclock_t ourClock = currClock->getClock(thread);
+/** Clears a byte cell, freeing its full record. */
+static void resetCell(shadowcell_t *shadow)
+{
+	shadowcell_t shadowval = *shadow;
+	if (shadowval != 0 && !ISSHORTRECORD(shadowval)) {
+		struct RaceRecord *record = RECORD(shadowval);
+		clearReads(record);
+		snapshot_free(record);
+	}
+	*shadow = 0;
+}
 
-		/* Thread ID is too large or clock is too large. */
-		if (threadid > MAXTHREADID || ourClock > MAXWRITEVECTOR) {
-			expandRecord(shadow);
-			fullRecordWriteNonAtomic(thread, location, shadow, currClock);
-			return;
+/** Resets the cell of the word at address word, for the bytes of the word
+ * that lie in the range from addr to end.  A word wholly in the range has
+ * its split word given back for reuse. */
+static void resetWordCell(shadowcell_t *cell, uintptr_t word, uintptr_t addr, uintptr_t end)
+{
+	shadowcell_t wordval = *cell;
+	if (wordval == 0)
+		return;
+	bool whole = word >= addr && word + SHADOWWORDSIZE <= end;
+	if (ISSPLITWORD(wordval)) {
+		struct ShadowSplitWord *split = SPLITWORD(wordval);
+		int shift = SPLITSHIFT(wordval);
+		for(int i = 0;i < (SHADOWWORDSIZE >> shift);i++)
+			if (word + (i << shift) >= addr && word + ((i + 1) << shift) <= end)
+				resetCell(&split->array[i]);
+		if (whole) {
+			freeSplitWord(wordval);
+			*cell = 0;
 		}
+	} else if (whole)
+		resetCell(cell);
+}
 
-		*shadow = ENCODEOP(0, 0, threadid, ourClock);
-		location = (void *)(((char *) location) + 1);
+/* Shadow pages whose residency is queried at once */
+#define RESETPAGES 64
+
+/**
+ * Resets the cells of the words from word to wordend, in the direct-mapped
+ * shadow.  Shadow pages that were never touched, which mincore reports as
+ * not resident, hold only empty cells and are skipped without being read.
+ * Pages whose cells all cover words wholly in the range from addr to end
+ * are given back to the kernel, which zeroes them, once the records their
+ * cells point to are released.
+ */
+static void resetFlatShadow(shadowcell_t *cells, uintptr_t word, uintptr_t wordend, uintptr_t addr, uintptr_t end)
+{
+	uintptr_t first = (uintptr_t)cells;
+	uintptr_t last = (uintptr_t)(cells + ((wordend - word) >> SHADOWWORDSHIFT));
+	/* Cells of the words wholly in the range */
+	uintptr_t wholefirst = addr > word ? first + sizeof(shadowcell_t) : first;
+	uintptr_t wholelast = end < wordend ? first + (((end - word) >> SHADOWWORDSHIFT) * sizeof(shadowcell_t)) : last;
+	uintptr_t dropstart = 0, dropend = 0;
+	unsigned char resident[RESETPAGES];
+	for(uintptr_t page = first & ~(uintptr_t)(PAGESIZE - 1);page < last;page += RESETPAGES * PAGESIZE) {
+		size_t num = (last - page + PAGESIZE - 1) / PAGESIZE;
+		if (num > RESETPAGES)
+			num = RESETPAGES;
+		if (mincore((void *)page, num * PAGESIZE, resident) < 0)
+			memset(resident, 1, num);
+		for(size_t i = 0;i < num;i++) {
+			uintptr_t pagestart = page + i * PAGESIZE;
+			if (!(resident[i] & 1))
+				continue;
+			uintptr_t start = pagestart > first ? pagestart : first;
+			uintptr_t stop = pagestart + PAGESIZE < last ? pagestart + PAGESIZE : last;
+			for(uintptr_t c = start;c < stop;c += sizeof(shadowcell_t))
+				resetWordCell((shadowcell_t *)c, word + (((c - first) / sizeof(shadowcell_t)) << SHADOWWORDSHIFT), addr, end);
+			if (pagestart < wholefirst || pagestart + PAGESIZE > wholelast)
+				continue;
+			if (pagestart != dropend) {
+				if (dropend != dropstart)
+					madvise((void *)dropstart, dropend - dropstart, MADV_DONTNEED);
+				dropstart = pagestart;
+			}
+			dropend = pagestart + PAGESIZE;
+		}
+	}
+	if (dropend != dropstart)
+		madvise((void *)dropstart, dropend - dropstart, MADV_DONTNEED);
+}
+
+/**
+ * Forgets the accesses to a range of memory that is being freed or
+ * unmapped, so that its next use does not race with stale accesses.  Full
+ * records are freed, and the split words of words wholly in the range are
+ * given back for reuse.  Words only partly in the range keep the state of
+ * the bytes outside it.
+ */
+void resetShadowRange(const void *location, size_t size)
+{
+	if (root == NULL)
+		return;
+	uintptr_t addr = (uintptr_t)location;
+	uintptr_t end = addr + size;
+	uintptr_t word = addr & ~(uintptr_t)SHADOWWORDMASK;
+	while (word < end) {
+		uintptr_t wordend = (end + SHADOWWORDMASK) & ~(uintptr_t)SHADOWWORDMASK;
+		uintptr_t base = flat_lowbase;
+		if (word - base >= flat_windowsize)
+			base = flat_highbase;
+		if (word - base < flat_windowsize) {
+			if (wordend - base > flat_windowsize || wordend < word)
+				wordend = base + flat_windowsize;
+			resetFlatShadow(peekWordEntry((const void *)word), word, wordend, addr, end);
+			word = wordend;
+			continue;
+		}
+
+		uintptr_t spanend = (word | 0xffffULL) + 1;
+		if (spanend > end || spanend == 0)
+			spanend = end;
+		shadowcell_t *cells = peekWordEntry((const void *)word);
+		if (cells == NULL) {
+			word = spanend;
+			continue;
+		}
+		for(;word < spanend;word += SHADOWWORDSIZE, cells++)
+			resetWordCell(cells, word, addr, end);
 	}
 }
 
 /** This function does race detection on a read for an expanded record. */
-struct DataRace * fullRaceCheckRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+struct DataRace * fullRaceCheckRead(thread_id_t thread, const void *location, shadowcell_t *shadow, ClockVector *currClock)
 {
-	struct RaceRecord *record = (struct RaceRecord *) (*shadow);
+	racestats->fullchecks++;
+	struct RaceRecord *record = RECORD(*shadow);
 	struct DataRace * race = NULL;
 	/* Check for datarace against last write. */
 
@@ -541,63 +1355,19 @@ struct DataRace * fullRaceCheckRead(thread_id_t thread, const void *location, ui
 		race = reportDataRace(writeThread, writeClock, true, get_execution()->get_parent_action(thread), false, location);
 	}
 
-	/* Shorten vector when possible */
-
-	int copytoindex = 0;
-
-	for (int i = 0;i < record->numReads;i++) {
-		modelclock_t readClock = record->readClock[i];
-		thread_id_t readThread = record->thread[i];
-
-		/*  Note that is not really a datarace check as reads cannot
-		                actually race.  It is just determining that this read subsumes
-		                another in the sense that either this read races or neither
-		                read races. Note that readClock can't actually be zero, so it
-		                could be optimized.  */
-
-		if (clock_may_race(currClock, thread, readClock, readThread)) {
-			/* Still need this read in vector */
-			if (copytoindex != i) {
-				ASSERT(readThread >= 0);
-				record->readClock[copytoindex] = readClock;
-				record->thread[copytoindex] = readThread;
-			}
-			copytoindex++;
-		}
-	}
-
-	if (__builtin_popcount(copytoindex) <= 1) {
-		if (copytoindex == 0 && record->thread == NULL) {
-			int newCapacity = INITCAPACITY;
-			record->thread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * newCapacity);
-			record->readClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * newCapacity);
-		} else if (copytoindex>=INITCAPACITY) {
-			int newCapacity = copytoindex * 2;
-			thread_id_t *newthread = (thread_id_t *)snapshot_malloc(sizeof(thread_id_t) * newCapacity);
-			modelclock_t *newreadClock = (modelclock_t *)snapshot_malloc(sizeof(modelclock_t) * newCapacity);
-			std::memcpy(newthread, record->thread, copytoindex * sizeof(thread_id_t));
-			std::memcpy(newreadClock, record->readClock, copytoindex * sizeof(modelclock_t));
-			snapshot_free(record->readClock);
-			snapshot_free(record->thread);
-			record->readClock = newreadClock;
-			record->thread = newthread;
-		}
-	}
-
-	modelclock_t ourClock = currClock->getClock(thread);
-
-	ASSERT(thread >= 0);
-	record->thread[copytoindex] = thread;
-	record->readClock[copytoindex] = ourClock;
-	record->numReads = copytoindex + 1;
+	addRead(record, thread, currClock->getClock(thread), currClock);
 	return race;
 }
 
 /** This function does race detection on a read. */
 void raceCheckRead(thread_id_t thread, const void *location)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	shadowcell_t *shadow = lookupAddressEntry(thread, location);
+	shadowcell_t shadowval = *shadow;
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
 		return;
@@ -620,6 +1390,7 @@ void raceCheckRead(thread_id_t thread, const void *location)
 			race = fullRaceCheckRead(thread, location, shadow, currClock);
 			goto Exit;
 		}
+		racestats->shortchecks++;
 
 		/* Check for datarace against last write. */
 
@@ -640,7 +1411,7 @@ ShadowExit:
 			if (clock_may_race(currClock, thread, readClock, readThread)) {
 				/* We don't subsume this read... Have to expand record. */
 				expandRecord(shadow);
-				fullRaceCheckRead(thread, location, shadow, currClock);
+				addRead(RECORD(*shadow), thread, ourClock, currClock);
 				goto Exit;
 			}
 		}
@@ -650,10 +1421,8 @@ ShadowExit:
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
@@ -662,9 +1431,9 @@ Exit:
 
 
 /** This function does race detection on a read for an expanded record. */
-struct DataRace * atomfullRaceCheckRead(thread_id_t thread, const void *location, uint64_t *shadow, ClockVector *currClock)
+struct DataRace * atomfullRaceCheckRead(thread_id_t thread, const void *location, shadowcell_t *shadow, ClockVector *currClock)
 {
-	struct RaceRecord *record = (struct RaceRecord *) (*shadow);
+	struct RaceRecord *record = RECORD(*shadow);
 	struct DataRace * race = NULL;
 	/* Check for datarace against last write. */
 	if (record->isAtomic)
@@ -681,10 +1450,9 @@ struct DataRace * atomfullRaceCheckRead(thread_id_t thread, const void *location
 }
 
 /** This function does race detection on a read. */
-void atomraceCheckRead(thread_id_t thread, const void *location)
+static inline void atomraceCheckRead_shadow(thread_id_t thread, const void *location, shadowcell_t *shadow)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
+	shadowcell_t shadowval = *shadow;
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
 		return;
@@ -716,20 +1484,23 @@ void atomraceCheckRead(thread_id_t thread, const void *location)
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
 	}
 }
 
-static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void * location, uint64_t *old_val, uint64_t *new_val)
+void atomraceCheckRead(thread_id_t thread, const void *location)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
+	atomraceCheckRead_shadow(thread, location, lookupAddressEntry(thread, location));
+}
+
+static inline shadowcell_t * raceCheckRead_firstIt(thread_id_t thread, const void * location, unsigned int len, int *shift, shadowcell_t *old_val, shadowcell_t *new_val)
+{
+	shadowcell_t *shadow = lookupGranuleEntry(thread, location, len, shift);
+	shadowcell_t shadowval = *shadow;
 
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
@@ -753,6 +1524,7 @@ static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void *
 			race = fullRaceCheckRead(thread, location, shadow, currClock);
 			goto Exit;
 		}
+		racestats->shortchecks++;
 
 		/* Check for datarace against last write. */
 		modelclock_t writeClock = WRITEVECTOR(shadowval);
@@ -769,10 +1541,7 @@ static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void *
 		if (clock_may_race(currClock, thread, readClock, readThread)) {
 			/* We don't subsume this read... Have to expand record. */
 			expandRecord(shadow);
-			struct RaceRecord *record = (struct RaceRecord *) (*shadow);
-			record->thread[1] = thread;
-			record->readClock[1] = ourClock;
-			record->numReads++;
+			addRead(RECORD(*shadow), thread, ourClock, currClock);
 
 			goto Exit;
 		}
@@ -785,10 +1554,8 @@ static inline uint64_t * raceCheckRead_firstIt(thread_id_t thread, const void *
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
@@ -797,10 +1564,8 @@ Exit:
 	return shadow;
 }
 
-static inline void raceCheckRead_otherIt(thread_id_t thread, const void * location) {
-	uint64_t *shadow = lookupAddressEntry(location);
-
-	uint64_t shadowval = *shadow;
+static inline void raceCheckRead_shadow(thread_id_t thread, const void * location, shadowcell_t *shadow) {
+	shadowcell_t shadowval = *shadow;
 
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
@@ -824,6 +1589,7 @@ static inline void raceCheckRead_otherIt(thread_id_t thread, const void * locati
 			race = fullRaceCheckRead(thread, location, shadow, currClock);
 			goto Exit;
 		}
+		racestats->shortchecks++;
 
 		/* Check for datarace against last write. */
 		modelclock_t writeClock = WRITEVECTOR(shadowval);
@@ -840,10 +1606,7 @@ static inline void raceCheckRead_otherIt(thread_id_t thread, const void * locati
 		if (clock_may_race(currClock, thread, readClock, readThread)) {
 			/* We don't subsume this read... Have to expand record. */
 			expandRecord(shadow);
-			struct RaceRecord *record = (struct RaceRecord *) (*shadow);
-			record->thread[1] = thread;
-			record->readClock[1] = ourClock;
-			record->numReads++;
+			addRead(RECORD(*shadow), thread, ourClock, currClock);
 
 			goto Exit;
 		}
@@ -853,125 +1616,97 @@ static inline void raceCheckRead_otherIt(thread_id_t thread, const void * locati
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
 	}
 }
 
-void raceCheckRead64(thread_id_t thread, const void *location)
+/**
+ * Checks a plain read of len bytes at location that lies in one word.  The
+ * first granule cell is checked in full; the others usually hold the same
+ * value, and are then given the same result.
+ */
+static inline void raceCheckReadWord(thread_id_t thread, const void *location, unsigned int len)
 {
-	uint64_t old_shadowval, new_shadowval;
+	shadowcell_t old_shadowval, new_shadowval;
 	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load64_count++;
-#endif
-	uint64_t * shadow = raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 7)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
-		if (shadow[4]==old_shadowval)
-			shadow[4] = new_shadowval;
-		else goto L4;
-		if (shadow[5]==old_shadowval)
-			shadow[5] = new_shadowval;
-		else goto L5;
-		if (shadow[6]==old_shadowval)
-			shadow[6] = new_shadowval;
-		else goto L6;
-		if (shadow[7]==old_shadowval)
-			shadow[7] = new_shadowval;
-		else goto L7;
-		return;
+	int shift;
+	shadowcell_t * shadow = raceCheckRead_firstIt(thread, location, len, &shift, &old_shadowval, &new_shadowval);
+	for(unsigned int i = 1;i < (len >> shift);i++) {
+		if (shadow[i] == old_shadowval)
+			shadow[i] = new_shadowval;
+		else
+			raceCheckRead_shadow(thread, (const void *)(((uintptr_t)location) + (i << shift)), &shadow[i]);
 	}
+}
 
-L1:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
-L4:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 4));
-L5:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 5));
-L6:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 6));
-L7:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 7));
+/** Checks a plain read of len bytes, which may straddle two words. */
+static inline void raceCheckReadSpan(thread_id_t thread, const void *location, unsigned int len)
+{
+	unsigned int first = SHADOWWORDSIZE - (((uintptr_t)location) & SHADOWWORDMASK);
+	if (len <= first) {
+		raceCheckReadWord(thread, location, len);
+	} else {
+		raceCheckReadWord(thread, location, first);
+		raceCheckReadWord(thread, (const void *)(((uintptr_t)location) + first), len - first);
+	}
 }
 
-void raceCheckRead32(thread_id_t thread, const void *location)
+void raceCheckRead64(thread_id_t thread, const void *location)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load32_count++;
-#endif
-	uint64_t * shadow = raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 3)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
+	racestats->reads[3]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
 		return;
+	if (sampleSkip(location))
+		return;
+	if (ISWORDALIGNED(location)) {
+		/* Aligned word access on an unsplit word: check the word cell once. */
+		shadowcell_t *word = lookupWordEntry(thread, location);
+		if (!ISSPLITWORD(*word)) {
+			raceCheckRead_shadow(thread, location, word);
+			return;
+		}
 	}
+	raceCheckReadSpan(thread, location, 8);
+}
 
-L1:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
+void raceCheckRead32(thread_id_t thread, const void *location)
+{
+	racestats->reads[2]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	raceCheckReadSpan(thread, location, 4);
 }
 
 void raceCheckRead16(thread_id_t thread, const void *location)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load16_count++;
-#endif
-	uint64_t * shadow = raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 1)) {
-		if (shadow[1]==old_shadowval) {
-			shadow[1] = new_shadowval;
-			return;
-		}
-	}
-	raceCheckRead_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
+	racestats->reads[1]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	raceCheckReadSpan(thread, location, 2);
 }
 
 void raceCheckRead8(thread_id_t thread, const void *location)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	load8_count++;
-#endif
-	raceCheckRead_firstIt(thread, location, &old_shadowval, &new_shadowval);
+	racestats->reads[0]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	raceCheckReadWord(thread, location, 1);
 }
 
-static inline uint64_t * raceCheckWrite_firstIt(thread_id_t thread, const void * location, uint64_t *old_val, uint64_t *new_val)
+static inline shadowcell_t * raceCheckWrite_firstIt(thread_id_t thread, const void * location, unsigned int len, int *shift, shadowcell_t *old_val, shadowcell_t *new_val)
 {
-	uint64_t *shadow = lookupAddressEntry(location);
-	uint64_t shadowval = *shadow;
+	shadowcell_t *shadow = lookupGranuleEntry(thread, location, len, shift);
+	shadowcell_t shadowval = *shadow;
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
 		return shadow;
@@ -993,6 +1728,7 @@ static inline uint64_t * raceCheckWrite_firstIt(thread_id_t thread, const void *
 			race = fullRaceCheckWrite(thread, location, shadow, currClock);
 			goto Exit;
 		}
+		racestats->shortchecks++;
 
 		{
 			/* Check for datarace against last read. */
@@ -1028,10 +1764,8 @@ ShadowExit:
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
@@ -1040,10 +1774,8 @@ Exit:
 	return shadow;
 }
 
-static inline void raceCheckWrite_otherIt(thread_id_t thread, const void * location) {
-	uint64_t *shadow = lookupAddressEntry(location);
-
-	uint64_t shadowval = *shadow;
+static inline void raceCheckWrite_shadow(thread_id_t thread, const void * location, shadowcell_t *shadow) {
+	shadowcell_t shadowval = *shadow;
 
 	ClockVector *currClock = get_execution()->get_cv(thread);
 	if (currClock == NULL)
@@ -1066,6 +1798,7 @@ static inline void raceCheckWrite_otherIt(thread_id_t thread, const void * locat
 			race = fullRaceCheckWrite(thread, location, shadow, currClock);
 			goto Exit;
 		}
+		racestats->shortchecks++;
 
 		{
 			/* Check for datarace against last read. */
@@ -1098,133 +1831,302 @@ ShadowExit:
 Exit:
 	if (race) {
 #ifdef REPORT_DATA_RACES
-		race->numframes=backtrace(race->backtrace, sizeof(race->backtrace)/sizeof(void*));
-		if (raceset->add(race))
-			assert_race(race);
-		else model_free(race);
+		captureBacktrace(race);
+		reportRace(race);
 #else
 		model_free(race);
 #endif
 	}
 }
 
-void raceCheckWrite64(thread_id_t thread, const void *location)
+/**
+ * Checks a plain write of len bytes at location that lies in one word.  The
+ * first granule cell is checked in full; the others usually hold the same
+ * value, and are then given the same result.
+ */
+static inline void raceCheckWriteWord(thread_id_t thread, const void *location, unsigned int len)
 {
-	uint64_t old_shadowval, new_shadowval;
+	shadowcell_t old_shadowval, new_shadowval;
 	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	store64_count++;
-#endif
-	uint64_t * shadow = raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 7)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
-		if (shadow[4]==old_shadowval)
-			shadow[4] = new_shadowval;
-		else goto L4;
-		if (shadow[5]==old_shadowval)
-			shadow[5] = new_shadowval;
-		else goto L5;
-		if (shadow[6]==old_shadowval)
-			shadow[6] = new_shadowval;
-		else goto L6;
-		if (shadow[7]==old_shadowval)
-			shadow[7] = new_shadowval;
-		else goto L7;
-		return;
+	int shift;
+	shadowcell_t * shadow = raceCheckWrite_firstIt(thread, location, len, &shift, &old_shadowval, &new_shadowval);
+	for(unsigned int i = 1;i < (len >> shift);i++) {
+		if (shadow[i] == old_shadowval)
+			shadow[i] = new_shadowval;
+		else
+			raceCheckWrite_shadow(thread, (const void *)(((uintptr_t)location) + (i << shift)), &shadow[i]);
 	}
+}
 
-L1:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
-L4:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 4));
-L5:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 5));
-L6:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 6));
-L7:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 7));
+/** Checks a plain write of len bytes, which may straddle two words. */
+static inline void raceCheckWriteSpan(thread_id_t thread, const void *location, unsigned int len)
+{
+	unsigned int first = SHADOWWORDSIZE - (((uintptr_t)location) & SHADOWWORDMASK);
+	if (len <= first) {
+		raceCheckWriteWord(thread, location, len);
+	} else {
+		raceCheckWriteWord(thread, location, first);
+		raceCheckWriteWord(thread, (const void *)(((uintptr_t)location) + first), len - first);
+	}
 }
 
-void raceCheckWrite32(thread_id_t thread, const void *location)
+void raceCheckWrite64(thread_id_t thread, const void *location)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	store32_count++;
-#endif
-	uint64_t * shadow = raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 3)) {
-		if (shadow[1]==old_shadowval)
-			shadow[1] = new_shadowval;
-		else goto L1;
-		if (shadow[2]==old_shadowval)
-			shadow[2] = new_shadowval;
-		else goto L2;
-		if (shadow[3]==old_shadowval)
-			shadow[3] = new_shadowval;
-		else goto L3;
+	racestats->writes[3]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
 		return;
+	if (sampleSkip(location))
+		return;
+	if (ISWORDALIGNED(location)) {
+		/* Aligned word access on an unsplit word: check the word cell once. */
+		shadowcell_t *word = lookupWordEntry(thread, location);
+		if (!ISSPLITWORD(*word)) {
+			raceCheckWrite_shadow(thread, location, word);
+			return;
+		}
 	}
+	raceCheckWriteSpan(thread, location, 8);
+}
 
-L1:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
-L2:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 2));
-L3:
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 3));
+void raceCheckWrite32(thread_id_t thread, const void *location)
+{
+	racestats->writes[2]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	raceCheckWriteSpan(thread, location, 4);
 }
 
 void raceCheckWrite16(thread_id_t thread, const void *location)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	store16_count++;
-#endif
+	racestats->writes[1]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	raceCheckWriteSpan(thread, location, 2);
+}
 
-	uint64_t * shadow = raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
-	if (CHECKBOUNDARY(location, 1)) {
-		if (shadow[1]==old_shadowval) {
-			shadow[1] = new_shadowval;
-			return;
+void raceCheckWrite8(thread_id_t thread, const void *location)
+{
+	racestats->writes[0]++;
+	if (stackfilter && isOwnStackAccess(thread, location))
+		return;
+	if (sampleSkip(location))
+		return;
+	raceCheckWriteWord(thread, location, 1);
+}
+
+/**
+ * Checks the accesses to a range, a span of contiguous word cells at a time.
+ * With reuse, for the plain race checks: the words of a buffer mostly carry
+ * the same shadow value, so once a value has been checked without a race,
+ * the cells that repeat it are simply given the same result.
+ */
+template<void (*check)(thread_id_t, const void *, shadowcell_t *), bool reuse, bool iswrite>
+static inline void checkShadowRange(thread_id_t thread, const void *location, size_t size)
+{
+	ClockVector *currClock = reuse ? get_execution()->get_cv(thread) : NULL;
+	if (reuse && currClock == NULL)
+		return;
+	shadowcell_t checkedval = INVALIDSHADOWVAL, resultval = INVALIDSHADOWVAL;
+	uintptr_t addr = (uintptr_t)location;
+	uintptr_t end = addr + size;
+	while (addr < end) {
+		if (ISWORDALIGNED(addr) && end - addr >= SHADOWWORDSIZE) {
+			uintptr_t spanend = SHADOWSPANEND(addr, end);
+			shadowcell_t *cells = lookupWordEntry(thread, (const void *)addr);
+			for(;addr < spanend;addr += SHADOWWORDSIZE, cells++) {
+				shadowcell_t val = *cells;
+				if (val == checkedval) {
+					*cells = resultval;
+				} else if (ISSPLITWORD(val)) {
+					shadowcell_t *granules = SPLITWORD(val)->array;
+					int shift = SPLITSHIFT(val);
+					for(int i = 0;i < (SHADOWWORDSIZE >> shift);i++)
+						check(thread, (const void *)(addr + (i << shift)), &granules[i]);
+				} else {
+					check(thread, (const void *)addr, cells);
+					/* The result only depends on the old value if it was a
+					 * compact one and no race was reported. */
+					if (reuse && (val == 0 || ISSHORTRECORD(val)) && ISSHORTRECORD(*cells) &&
+							!clock_may_race(currClock, thread, WRITEVECTOR(val), int_to_id(WRTHREADID(val))) &&
+							!(iswrite && clock_may_race(currClock, thread, READVECTOR(val), int_to_id(RDTHREADID(val))))) {
+						checkedval = val;
+						resultval = *cells;
+					}
+				}
+			}
+			continue;
 		}
+		uintptr_t wordend = (addr | SHADOWWORDMASK) + 1;
+		if (wordend > end)
+			wordend = end;
+		int shift;
+		shadowcell_t *granules = lookupGranuleEntry(thread, (const void *)addr, wordend - addr, &shift);
+		for(int i = 0;addr < wordend;i++, addr += 1 << shift)
+			check(thread, (const void *)addr, &granules[i]);
 	}
-	raceCheckWrite_otherIt(thread, (const void *)(((uintptr_t)location) + 1));
 }
 
-void raceCheckWrite8(thread_id_t thread, const void *location)
+/** This function does race detection for a normal access to a range of
+ * memory.  The own-stack filter and the sampling mode decide for the range
+ * as a whole, by its first word. */
+void raceCheckRange(thread_id_t thread, const void *location, size_t size, bool iswrite)
 {
-	uint64_t old_shadowval, new_shadowval;
-	old_shadowval = new_shadowval = INVALIDSHADOWVAL;
-#ifdef COLLECT_STAT
-	store8_count++;
-#endif
-	raceCheckWrite_firstIt(thread, location, &old_shadowval, &new_shadowval);
+	if (iswrite)
+		racestats->rangewrites++;
+	else
+		racestats->rangereads++;
+	if (stackfilter && isOwnStackRange(thread, location, size))
+		return;
+	if (sampleSkip(location))
+		return;
+	if (iswrite)
+		checkShadowRange<raceCheckWrite_shadow, true, true>(thread, location, size);
+	else
+		checkShadowRange<raceCheckRead_shadow, true, false>(thread, location, size);
 }
 
-#ifdef COLLECT_STAT
-void print_normal_accesses()
+/* Sized entry points for atomic accesses and atomic RMW updates. */
+#define ATOMICRACECHECKS(size)                                          \
+	void atomraceCheckWrite ## size(thread_id_t thread, const void *location) { \
+		checkShadowRange<atomraceCheckWrite_shadow, false, false>(thread, location, size / 8); \
+		if (size == 64 && stackfilter == 1)                             \
+			noteStackEscape(thread, *(const uint64_t *)location);       \
+	}                                                               \
+	void atomraceCheckRead ## size(thread_id_t thread, const void *location) { \
+		checkShadowRange<atomraceCheckRead_shadow, false, false>(thread, location, size / 8); \
+	}                                                               \
+	void recordWrite ## size(thread_id_t thread, const void *location) { \
+		checkShadowRange<recordWrite_shadow, false, false>(thread, location, size / 8); \
+		if (size == 64 && stackfilter == 1)                             \
+			noteStackEscape(thread, *(const uint64_t *)location);       \
+	}
+
+ATOMICRACECHECKS(8)
+ATOMICRACECHECKS(16)
+ATOMICRACECHECKS(32)
+ATOMICRACECHECKS(64)
+
+/** Copies the race detector's counters, to be reported with the execution stats. */
+void getRaceStats(struct race_stats *stats)
 {
-	model_print("store 8  count: %u\n", store8_count);
-	model_print("store 16 count: %u\n", store16_count);
-	model_print("store 32 count: %u\n", store32_count);
-	model_print("store 64 count: %u\n", store64_count);
+	if (racestats)
+		*stats = *racestats;
+}
 
-	model_print("load  8  count: %u\n", load8_count);
-	model_print("load  16 count: %u\n", load16_count);
-	model_print("load  32 count: %u\n", load32_count);
-	model_print("load  64 count: %u\n", load64_count);
+/** Adds a worker process's race detector counters to the totals of a
+ * parallel run, which other workers update at the same time. */
+void mergeRaceStats(struct race_stats *total, const struct race_stats *stats)
+{
+	for(int i = 0;i < 4;i++) {
+		__sync_fetch_and_add(&total->reads[i], stats->reads[i]);
+		__sync_fetch_and_add(&total->writes[i], stats->writes[i]);
+	}
+	__sync_fetch_and_add(&total->shortchecks, stats->shortchecks);
+	__sync_fetch_and_add(&total->fullchecks, stats->fullchecks);
+	__sync_fetch_and_add(&total->expandedrecords, stats->expandedrecords);
+	__sync_fetch_and_add(&total->tablesallocated, stats->tablesallocated);
+	__sync_fetch_and_add(&total->lanewords, stats->lanewords);
+	__sync_fetch_and_add(&total->splitwords, stats->splitwords);
+	__sync_fetch_and_add(&total->reportedraces, stats->reportedraces);
+	__sync_fetch_and_add(&total->duplicateraces, stats->duplicateraces);
+	__sync_fetch_and_add(&total->tablelookups, stats->tablelookups);
+	__sync_fetch_and_add(&total->lookasidehits, stats->lookasidehits);
+	__sync_fetch_and_add(&total->skippedchecks, stats->skippedchecks);
+	__sync_fetch_and_add(&total->filteredraces, stats->filteredraces);
+	__sync_fetch_and_add(&total->stackskips, stats->stackskips);
+	__sync_fetch_and_add(&total->rangereads, stats->rangereads);
+	__sync_fetch_and_add(&total->rangewrites, stats->rangewrites);
+}
+
+/** Prints race detector counters, one kind of work per line. */
+static void printRaceCounters(const struct race_stats *stats)
+{
+	model_print("Race checks by size (8/16/32/64 bit): reads %" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64
+							", writes %" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64 "\n",
+							stats->reads[0], stats->reads[1], stats->reads[2], stats->reads[3],
+							stats->writes[0], stats->writes[1], stats->writes[2], stats->writes[3]);
+	if (stats->rangereads != 0 || stats->rangewrites != 0)
+		model_print("Race checks of ranges, by memory and string functions: reads %" PRIu64 ", writes %" PRIu64 "\n",
+								stats->rangereads, stats->rangewrites);
+	model_print("Shadow cells checked: %" PRIu64 " compact, %" PRIu64 " full records (%" PRIu64 " records expanded)\n",
+							stats->shortchecks, stats->fullchecks, stats->expandedrecords);
+	model_print("Shadow tables allocated: %" PRIu64 ", words split by access size: %" PRIu64 ", for mixed sizes: %" PRIu64 "\n",
+							stats->tablesallocated, stats->lanewords, stats->splitwords);
+	model_print("Races reported: %" PRIu64 ", duplicates dropped: %" PRIu64 "\n",
+							stats->reportedraces, stats->duplicateraces);
+	if (stats->tablelookups != 0)
+		model_print("Shadow table lookups: %" PRIu64 ", lookaside cache hit rate %.1f%%\n",
+								stats->tablelookups, 100.0 * stats->lookasidehits / stats->tablelookups);
+	if (stats->skippedchecks != 0)
+		model_print("Race checks skipped by sampling: %" PRIu64 "\n", stats->skippedchecks);
+	if (stats->filteredraces != 0)
+		model_print("Repeated races filtered: %" PRIu64 "\n", stats->filteredraces);
+	if (stats->stackskips != 0)
+		model_print("Own-stack accesses not checked: %" PRIu64 "\n", stats->stackskips);
+}
+
+/** Prints race detector counters as one line of JSON for tools: head, then
+ * an object of the counters, then a closing brace. */
+static void printRaceCountersJSON(const char *head, const struct race_stats *stats)
+{
+	model_print("%s{\"reads\": [%" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 "], "
+							"\"writes\": [%" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 "], "
+							"\"shortchecks\": %" PRIu64 ", \"fullchecks\": %" PRIu64 ", \"expandedrecords\": %" PRIu64 ", "
+							"\"tablesallocated\": %" PRIu64 ", \"lanewords\": %" PRIu64 ", \"splitwords\": %" PRIu64 ", "
+							"\"reportedraces\": %" PRIu64 ", \"duplicateraces\": %" PRIu64 ", \"filteredraces\": %" PRIu64 ", "
+							"\"tablelookups\": %" PRIu64 ", \"lookasidehits\": %" PRIu64 ", "
+							"\"skippedchecks\": %" PRIu64 ", \"stackskips\": %" PRIu64 ", "
+							"\"rangereads\": %" PRIu64 ", \"rangewrites\": %" PRIu64 "}}\n",
+							head, stats->reads[0], stats->reads[1], stats->reads[2], stats->reads[3],
+							stats->writes[0], stats->writes[1], stats->writes[2], stats->writes[3],
+							stats->shortchecks, stats->fullchecks, stats->expandedrecords,
+							stats->tablesallocated, stats->lanewords, stats->splitwords,
+							stats->reportedraces, stats->duplicateraces, stats->filteredraces,
+							stats->tablelookups, stats->lookasidehits,
+							stats->skippedchecks, stats->stackskips,
+							stats->rangereads, stats->rangewrites);
+}
+
+/** Prints race detector counters, totals over the executions so far and
+ * possibly over several processes, then, if json is set, the same totals
+ * as one line of JSON for tools. */
+void printRaceStats(const struct race_stats *stats, int executions, bool json)
+{
+	printRaceCounters(stats);
+	if (!json)
+		return;
+	char head[64];
+	snprintf(head, sizeof(head), "RACESTATS {\"executions\": %d, \"totals\": ", executions);
+	printRaceCountersJSON(head, stats);
+}
+
+/** Prints the race detector counters of one execution: the work it did,
+ * as printRaceStats does for the totals, or, if json is set, only the
+ * JSON line, which tools can use to find costly executions. */
+void printExecutionRaceStats(const struct race_stats *stats, int execution, bool json)
+{
+	if (!json) {
+		model_print("Race detector counters of execution %d:\n", execution);
+		printRaceCounters(stats);
+		return;
+	}
+	char head[64];
+	snprintf(head, sizeof(head), "RACESTATS_EXECUTION {\"execution\": %d, \"counters\": ", execution);
+	printRaceCountersJSON(head, stats);
+}
+
+/** Sets delta to the counters of stats minus those of start, such as the
+ * work done since the start of an execution. */
+void diffRaceStats(struct race_stats *delta, const struct race_stats *stats, const struct race_stats *start)
+{
+	/* All counters are uint64_t */
+	const uint64_t *now = (const uint64_t *)stats;
+	const uint64_t *before = (const uint64_t *)start;
+	uint64_t *out = (uint64_t *)delta;
+	for(size_t i = 0;i < sizeof(struct race_stats) / sizeof(uint64_t);i++)
+		out[i] = now[i] - before[i];
 }
-#endif
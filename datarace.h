@@ -15,8 +15,54 @@ struct ShadowTable {
 	void * array[65536];
 };
 
+/* A shadow cell holds either a compact record of the last accesses, or a
+ * pointer; see ENCODEOP below. */
+#ifdef COMPACT_SHADOW_CELLS
+typedef uint64_t shadowcell_t;
+#else
+/* Only 8 byte alignment is needed: the snapshot heap does not give more */
+typedef unsigned __int128 shadowcell_t __attribute__((aligned(8)));
+#endif
+
+/* Shadow cells normally cover an aligned 8-byte word.  A word accessed by
+ * narrower accesses is split into cells for granules of the access size,
+ * and split further only when an access of a different size or alignment
+ * hits it. */
+#define SHADOWWORDSHIFT 3
+#define SHADOWWORDSIZE (1 << SHADOWWORDSHIFT)
+#define SHADOWWORDMASK (SHADOWWORDSIZE - 1)
+
+/* Where possible, two windows of the address space, around the program's
+ * heap and around the stacks and mappings, have a direct-mapped shadow with
+ * one word cell per word.  Other addresses use the ShadowTable tree. */
+/* End of the run of whole words from an aligned address up to end whose
+ * word cells are contiguous: base tables cover 64KB pages. */
+#define SHADOWSPANEND(addr, end) ((((addr) | 0xffffULL) + 1) < ((end) & ~(uintptr_t)SHADOWWORDMASK) ? \
+																	(((addr) | 0xffffULL) + 1) : ((end) & ~(uintptr_t)SHADOWWORDMASK))
+
+#define FLATSHADOWWINDOW (1ULL << 40)
+#define FLATSHADOWSIZE ((FLATSHADOWWINDOW >> SHADOWWORDSHIFT) * sizeof(shadowcell_t))
+
+/* Lookaside cache of shadow base tables: slots per thread, and number of
+ * per-thread caches (threads beyond that share them).  Powers of two. */
+#define LOOKASIDEENTRIES 4
+#define LOOKASIDETHREADS 64
+
+/* Slots in the table of per-word sampling state (a power of two).  Words
+ * that collide in the table are checked on every access. */
+#define SAMPLESLOTS (1 << 14)
+
+/* Slots in the filter of races already seen (a power of two) */
+#define RACEFILTERSLOTS 1024
+
 struct ShadowBaseTable {
-	uint64_t array[65536];
+	shadowcell_t array[65536 >> SHADOWWORDSHIFT];
+};
+
+/* The cells of a split word: only the first SHADOWWORDSIZE >> shift of
+ * them are allocated, for granules of 2^shift bytes. */
+struct ShadowSplitWord {
+	shadowcell_t array[SHADOWWORDSIZE];
 };
 
 struct DataRace {
@@ -38,11 +84,58 @@ struct DataRace {
 	const void *address;
 	void * backtrace[64];
 	int numframes;
+	/* First frame that belongs to the program under test. */
+	int firstframe;
 };
 
 #define MASK16BIT 0xffff
 
+/** @brief Race detector counters, kept across executions */
+struct race_stats {
+	/** @brief Plain reads and writes, by size: 8, 16, 32 and 64 bit */
+	uint64_t reads[4];
+	uint64_t writes[4];
+	/** @brief Shadow cells checked that held a compact record */
+	uint64_t shortchecks;
+	/** @brief Shadow cells checked that held a full record */
+	uint64_t fullchecks;
+	/** @brief Compact records turned into full records */
+	uint64_t expandedrecords;
+	/** @brief Shadow tables of the table tree allocated */
+	uint64_t tablesallocated;
+	/** @brief Unused word cells given cells for the granules of a narrow access */
+	uint64_t lanewords;
+	/** @brief Word cells split further, by an access of a different size */
+	uint64_t splitwords;
+	/** @brief Races printed */
+	uint64_t reportedraces;
+	/** @brief Races dropped after unwinding, as duplicates of printed ones */
+	uint64_t duplicateraces;
+	/** @brief Shadow lookups that went to the table tree */
+	uint64_t tablelookups;
+	/** @brief Table lookups served by the lookaside cache */
+	uint64_t lookasidehits;
+	/** @brief Non-atomic accesses left unchecked by the sampling mode */
+	uint64_t skippedchecks;
+	/** @brief Repeated races dropped before their stack was unwound */
+	uint64_t filteredraces;
+	/** @brief Accesses to the accessing thread's own stack left unchecked */
+	uint64_t stackskips;
+	/** @brief Ranges read and written by memory and string functions */
+	uint64_t rangereads;
+	uint64_t rangewrites;
+};
+
+/* Program location of the access being checked, set by the entry points
+ * that the program calls; the race filter is keyed on it. */
+extern const void *racesite;
+
 void initRaceDetector();
+void getRaceStats(struct race_stats *stats);
+void mergeRaceStats(struct race_stats *total, const struct race_stats *stats);
+void printRaceStats(const struct race_stats *stats, int executions, bool json);
+void printExecutionRaceStats(const struct race_stats *stats, int execution, bool json);
+void diffRaceStats(struct race_stats *delta, const struct race_stats *stats, const struct race_stats *start);
 void raceCheckWrite(thread_id_t thread, void *location);
 void atomraceCheckWrite(thread_id_t thread, void *location);
 void raceCheckRead(thread_id_t thread, const void *location);
@@ -50,6 +143,7 @@ void raceCheckRead(thread_id_t thread, const void *location);
 void atomraceCheckRead(thread_id_t thread, const void *location);
 void recordWrite(thread_id_t thread, void *location);
 void recordCalloc(void *location, size_t size);
+void resetShadowRange(const void *location, size_t size);
 void assert_race(struct DataRace *race);
 bool hasNonAtomicStore(const void *location);
 void setAtomicStoreFlag(const void *location);
@@ -65,18 +159,51 @@ void raceCheckWrite16(thread_id_t thread, const void *location);
 void raceCheckWrite32(thread_id_t thread, const void *location);
 void raceCheckWrite64(thread_id_t thread, const void *location);
 
-#ifdef COLLECT_STAT
-void print_normal_accesses();
-#endif
+void atomraceCheckWrite8(thread_id_t thread, const void *location);
+void atomraceCheckWrite16(thread_id_t thread, const void *location);
+void atomraceCheckWrite32(thread_id_t thread, const void *location);
+void atomraceCheckWrite64(thread_id_t thread, const void *location);
+
+void atomraceCheckRead8(thread_id_t thread, const void *location);
+void atomraceCheckRead16(thread_id_t thread, const void *location);
+void atomraceCheckRead32(thread_id_t thread, const void *location);
+void atomraceCheckRead64(thread_id_t thread, const void *location);
+
+void recordWrite8(thread_id_t thread, const void *location);
+void recordWrite16(thread_id_t thread, const void *location);
+void recordWrite32(thread_id_t thread, const void *location);
+void recordWrite64(thread_id_t thread, const void *location);
+
+void raceCheckRange(thread_id_t thread, const void *location, size_t size, bool iswrite);
+
+void setThreadStackTop(thread_id_t thread, const void *top);
+void noteStackEscape(thread_id_t thread, uint64_t value);
+
+/**
+ * @brief The clock of the last read by each thread, for a location read
+ * concurrently by several threads
+ *
+ * Read vectors are reference counted and shared between records with the
+ * same reads; they are copied before being changed while shared.
+ */
+struct ReadVector {
+	int refcount;
+	int size;
+	modelclock_t clock[];
+};
 
 /**
  * @brief A record of information for detecting data races
+ *
+ * While reads are totally ordered, only the last one is kept as an epoch
+ * (readThread, readClock).  Once two reads are concurrent, readVector holds
+ * the last read of every thread until the next write.
  */
 struct RaceRecord {
-	modelclock_t *readClock;
-	thread_id_t *thread;
-	int numReads : 31;
-	int isAtomic : 1;
+	struct ReadVector *readVector;
+	thread_id_t readThread;
+	modelclock_t readClock;
+	int isAtomic;
 	thread_id_t writeThread;
 	modelclock_t writeClock;
 };
@@ -84,10 +211,34 @@ struct RaceRecord {
 unsigned int race_hash(struct DataRace *race);
 bool race_equals(struct DataRace *r1, struct DataRace *r2);
 
-#define INITCAPACITY 4
-
 #define ISSHORTRECORD(x) ((x)&0x1)
 
+#define SPLITTAG 0x2ULL
+#define ISSPLITWORD(x) (((x)&0x3)==SPLITTAG)
+/* The granule shift of a split word is kept in the top bits of the pointer */
+#define SPLITSHIFT(x) ((int)(((x)>>62)&0x3))
+#define SPLITWORD(x) ((struct ShadowSplitWord *)(uintptr_t)((x)&0x3ffffffffffffffcULL))
+#define ENCODESPLIT(p, shift) (ENCODEPTR(p) | SPLITTAG | ((shadowcell_t)(shift) << 62))
+#define RECORD(x) ((struct RaceRecord *)(uintptr_t)(x))
+#define ENCODEPTR(p) ((shadowcell_t)(uintptr_t)(p))
+
+/**
+ * The basic encoding idea is that a shadow cell either:
+ *  -# points to a full record (RaceRecord),
+ *  -# for a word cell only, points to the granule cells of a split word
+ *     (ShadowSplitWord) with SPLITTAG set in the low bits, or
+ *  -# encodes the information in the cell itself.
+ */
+#ifdef COMPACT_SHADOW_CELLS
+/**
+ * Compact 64 bit cells:
+ *  - lowest bit set to 1
+ *  - next 6 bits are read thread id
+ *  - next 25 bits are read clock vector
+ *  - next 6 bits are write thread id
+ *  - next 25 bits are write clock vector
+ *  - highest bit is 1 if the write is from an atomic
+ */
 #define THREADMASK 0x3f
 #define RDTHREADID(x) (((x)>>1)&THREADMASK)
 #define READMASK 0x1ffffff
@@ -99,28 +250,40 @@ bool race_equals(struct DataRace *r1, struct DataRace *r2);
 #define WRITEVECTOR(x) (((x)>>38)&WRITEMASK)
 
 #define ATOMICMASK (0x1ULL << 63)
-#define NONATOMICMASK ~(0x1ULL << 63)
 
+#define ENCODEOP(rdthread, rdtime, wrthread, wrtime) (0x1ULL | ((rdthread)<<1) | ((rdtime) << 7) | (((uint64_t)wrthread)<<32) | (((uint64_t)wrtime)<<38))
+#else
 /**
- * The basic encoding idea is that (void *) either:
- *  -# points to a full record (RaceRecord) or
- *  -# encodes the information in a 64 bit word. Encoding is as
- *     follows:
- *     - lowest bit set to 1
- *     - next 6 bits are read thread id
- *     - next 25 bits are read clock vector
- *     - next 6 bits are write thread id
- *     - next 25 bits are write clock vector
- *     - highest bit is 1 if the write is from an atomic
+ * Wide 128 bit cells, which hold any clock and all but absurd thread ids:
+ *  - lowest bit set to 1
+ *  - next 31 bits are read thread id
+ *  - next 32 bits are read clock vector
+ *  - next 31 bits are write thread id
+ *  - next 32 bits are write clock vector
+ *  - highest bit is 1 if the write is from an atomic
  */
-#define ENCODEOP(rdthread, rdtime, wrthread, wrtime) (0x1ULL | ((rdthread)<<1) | ((rdtime) << 7) | (((uint64_t)wrthread)<<32) | (((uint64_t)wrtime)<<38))
+#define THREADMASK 0x7fffffff
+#define RDTHREADID(x) ((int)(((x)>>1)&THREADMASK))
+#define READMASK 0xffffffffU
+#define READVECTOR(x) ((modelclock_t)(((x)>>32)&READMASK))
+
+#define WRTHREADID(x) ((int)(((x)>>64)&THREADMASK))
+
+#define WRITEMASK READMASK
+#define WRITEVECTOR(x) ((modelclock_t)(((x)>>95)&WRITEMASK))
+
+#define ATOMICMASK ((shadowcell_t)1 << 127)
+
+#define ENCODEOP(rdthread, rdtime, wrthread, wrtime) ((shadowcell_t)0x1 | (((shadowcell_t)(rdthread))<<1) | (((shadowcell_t)(rdtime)) << 32) | (((shadowcell_t)(wrthread))<<64) | (((shadowcell_t)(wrtime))<<95))
+#endif
 
 #define MAXTHREADID (THREADMASK-1)
 #define MAXREADVECTOR (READMASK-1)
 #define MAXWRITEVECTOR (WRITEMASK-1)
 
 #define INVALIDSHADOWVAL 0x2ULL
-#define CHECKBOUNDARY(location, bits) ((((uintptr_t)location & MASK16BIT) + bits) <= MASK16BIT)
+#define CHECKBOUNDARY(location, bits) ((((uintptr_t)location & SHADOWWORDMASK) + bits) <= SHADOWWORDMASK)
+#define ISWORDALIGNED(location) ((((uintptr_t)location) & SHADOWWORDMASK) == 0)
 
 typedef HashSet<struct DataRace *, uintptr_t, 0, model_malloc, model_calloc, model_free, race_hash, race_equals> RaceSet;
 
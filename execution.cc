@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <new>
 #include <stdarg.h>
+#include <limits.h>
 
 #include "model.h"
 #include "execution.h"
@@ -69,15 +70,16 @@ ModelExecution::ModelExecution(ModelChecker *m, Scheduler *scheduler) :
 	pthread_map(0),
 	pthread_counter(2),
 	action_trace(),
-	obj_map(),
-	condvar_waiters_map(),
-	obj_thrd_map(),
-	obj_wr_thrd_map(),
-	obj_last_sc_map(),
+	obj_states(),
 	mutex_map(),
 	cond_map(),
 	thrd_last_action(1),
 	thrd_last_fence_release(),
+	thrd_sc_fences(),
+	scratch_rf_set(),
+	scratch_priorset(),
+	scratch_edgeset(),
+	scratch_processset(),
 	priv(new struct model_snapshot_members ()),
 	mo_graph(new CycleGraph()),
 #ifdef NEWFUZZER
@@ -112,34 +114,36 @@ int ModelExecution::get_execution_number() const
 	return model->get_execution_number();
 }
 
-static SnapVector<action_list_t> * get_safe_ptr_vect_action(HashTable<const void *, SnapVector<action_list_t> *, uintptr_t, 2> * hash, void * ptr)
+/** @return The state of an object, created on its first use */
+ObjectState * ModelExecution::get_obj_state(const void *location)
 {
-	SnapVector<action_list_t> *tmp = hash->get(ptr);
-	if (tmp == NULL) {
-		tmp = new SnapVector<action_list_t>();
-		hash->put(ptr, tmp);
+	ObjectState *state = obj_states.get(location);
+	if (state == NULL) {
+		state = new ObjectState();
+		obj_states.put(location, state);
 	}
-	return tmp;
+	return state;
 }
 
-static simple_action_list_t * get_safe_ptr_action(HashTable<const void *, simple_action_list_t *, uintptr_t, 2> * hash, void * ptr)
+/** @return The state of the location of an action, cached in the action */
+ObjectState * ModelExecution::get_obj_state(ModelAction *act)
 {
-	simple_action_list_t *tmp = hash->get(ptr);
-	if (tmp == NULL) {
-		tmp = new simple_action_list_t();
-		hash->put(ptr, tmp);
+	ObjectState *state = act->get_obj_state();
+	if (state == NULL) {
+		state = get_obj_state(act->get_location());
+		act->set_obj_state(state);
 	}
-	return tmp;
+	return state;
 }
 
-static SnapVector<simple_action_list_t> * get_safe_ptr_vect_action(HashTable<const void *, SnapVector<simple_action_list_t> *, uintptr_t, 2> * hash, void * ptr)
+/** @return The state of the location of an action, or NULL if the location
+ *  was never used */
+ObjectState * ModelExecution::find_obj_state(const ModelAction *act) const
 {
-	SnapVector<simple_action_list_t> *tmp = hash->get(ptr);
-	if (tmp == NULL) {
-		tmp = new SnapVector<simple_action_list_t>();
-		hash->put(ptr, tmp);
-	}
-	return tmp;
+	ObjectState *state = act->get_obj_state();
+	if (state == NULL)
+		state = obj_states.get(act->get_location());
+	return state;
 }
 
 /**
@@ -375,7 +379,8 @@ ModelAction * ModelExecution::convertNonAtomicStore(void * location) {
  */
 bool ModelExecution::process_read(ModelAction *curr, SnapVector<ModelAction *> * rf_set)
 {
-	SnapVector<ModelAction *> * priorset = new SnapVector<ModelAction *>();
+	SnapVector<ModelAction *> * priorset = &scratch_priorset;
+	priorset->clear();
 	bool hasnonatomicstore = hasNonAtomicStore(curr->get_location());
 	if (hasnonatomicstore) {
 		ModelAction * nonatomicstore = convertNonAtomicStore(curr->get_location());
@@ -407,7 +412,6 @@ bool ModelExecution::process_read(ModelAction *curr, SnapVector<ModelAction *> *
 			}
 			read_from(curr, rf);
 			get_thread(curr)->set_return_value(rf->get_write_value());
-			delete priorset;
 			//Update acquire fence clock vector
 			ClockVector * hbcv = get_hb_from_write(rf);
 			if (hbcv != NULL)
@@ -485,7 +489,7 @@ bool ModelExecution::process_mutex(ModelAction *curr)
 			state->locked = NULL;
 
 			/* remove old wait action and disable this thread */
-			simple_action_list_t * waiters = get_safe_ptr_action(&condvar_waiters_map, curr->get_location());
+			simple_action_list_t * waiters = &get_obj_state(curr)->waiters;
 			for (sllnode<ModelAction *> * it = waiters->begin();it != NULL;it = it->getNext()) {
 				ModelAction * wait = it->getVal();
 				if (wait->get_tid() == curr->get_tid()) {
@@ -525,7 +529,7 @@ bool ModelExecution::process_mutex(ModelAction *curr)
 		break;
 	}
 	case ATOMIC_NOTIFY_ALL: {
-		simple_action_list_t *waiters = get_safe_ptr_action(&condvar_waiters_map, curr->get_location());
+		simple_action_list_t *waiters = &get_obj_state(curr)->waiters;
 		//activate all the waiting threads
 		for (sllnode<ModelAction *> * rit = waiters->begin();rit != NULL;rit=rit->getNext()) {
 			scheduler->wake(get_thread(rit->getVal()));
@@ -534,7 +538,7 @@ bool ModelExecution::process_mutex(ModelAction *curr)
 		break;
 	}
 	case ATOMIC_NOTIFY_ONE: {
-		simple_action_list_t *waiters = get_safe_ptr_action(&condvar_waiters_map, curr->get_location());
+		simple_action_list_t *waiters = &get_obj_state(curr)->waiters;
 		if (waiters->size() != 0) {
 			Thread * thread = fuzzer->selectNotify(waiters);
 			scheduler->wake(thread);
@@ -811,15 +815,12 @@ ModelAction * ModelExecution::check_current_action(ModelAction *curr)
 
 	wake_up_sleeping_actions(curr);
 
-	SnapVector<ModelAction *> * rf_set = NULL;
 	bool canprune = false;
 	/* Build may_read_from set for newly-created actions */
 	if (curr->is_read() && newly_explored) {
-		rf_set = build_may_read_from(curr);
-		canprune = process_read(curr, rf_set);
-		delete rf_set;
-	} else
-		ASSERT(rf_set == NULL);
+		build_may_read_from(curr, &scratch_rf_set);
+		canprune = process_read(curr, &scratch_rf_set);
+	}
 
 	/* Add the action to lists if not the second part of a rmw */
 	if (newly_explored) {
@@ -851,7 +852,9 @@ ModelAction * ModelExecution::process_rmw(ModelAction *act) {
 	ModelAction *lastread = get_last_action(act->get_tid());
 	lastread->process_rmw(act);
 	if (act->is_rmw()) {
-		mo_graph->addRMWEdge(lastread->get_reads_from(), lastread);
+		ModelAction *rf = lastread->get_reads_from();
+		mo_graph->addRMWEdge(rf, lastread);
+		get_obj_state(rf)->thrd_writes[id_to_int(rf->get_tid())].setRMWConsumed(rf);
 	}
 	return lastread;
 }
@@ -879,7 +882,7 @@ ModelAction * ModelExecution::process_rmw(ModelAction *act) {
 bool ModelExecution::r_modification_order(ModelAction *curr, const ModelAction *rf,
 																					SnapVector<ModelAction *> * priorset, bool * canprune)
 {
-	SnapVector<action_list_t> *thrd_lists = obj_thrd_map.get(curr->get_location());
+	SnapVector<action_list_t> *thrd_lists = &get_obj_state(curr)->thrd_actions;
 	ASSERT(curr->is_read());
 
 	/* Last SC fence in the current thread */
@@ -1022,21 +1025,23 @@ bool ModelExecution::r_modification_order(ModelAction *curr, const ModelAction *
  */
 void ModelExecution::w_modification_order(ModelAction *curr)
 {
-	SnapVector<action_list_t> *thrd_lists = obj_thrd_map.get(curr->get_location());
+	ObjectState *state = get_obj_state(curr);
+	SnapVector<action_list_t> *thrd_lists = &state->thrd_actions;
 	unsigned int i;
 	ASSERT(curr->is_write());
 
-	SnapList<ModelAction *> edgeset;
+	SnapVector<ModelAction *> * edgeset = &scratch_edgeset;
+	edgeset->clear();
 
 	if (curr->is_seqcst()) {
 		/* We have to at least see the last sequentially consistent write,
 		         so we are initialized. */
-		ModelAction *last_seq_cst = get_last_seq_cst_write(curr);
+		ModelAction *last_seq_cst = state->last_sc_write;
 		if (last_seq_cst != NULL) {
-			edgeset.push_back(last_seq_cst);
+			edgeset->push_back(last_seq_cst);
 		}
-		//update map for next query
-		obj_last_sc_map.put(curr->get_location(), curr);
+		//update state for next query
+		state->last_sc_write = curr;
 	}
 
 	/* Last SC fence in the current thread */
@@ -1078,7 +1083,7 @@ void ModelExecution::w_modification_order(ModelAction *curr)
 			/* C++, Section 29.3 statement 7 */
 			if (last_sc_fence_thread_before && act->is_write() &&
 					*act < *last_sc_fence_thread_before) {
-				edgeset.push_back(act);
+				edgeset->push_back(act);
 				break;
 			}
 
@@ -1094,16 +1099,16 @@ void ModelExecution::w_modification_order(ModelAction *curr)
 				 *   readfrom(act) --mo--> act
 				 */
 				if (act->is_write())
-					edgeset.push_back(act);
+					edgeset->push_back(act);
 				else if (act->is_read()) {
 					//if previous read accessed a null, just keep going
-					edgeset.push_back(act->get_reads_from());
+					edgeset->push_back(act->get_reads_from());
 				}
 				break;
 			}
 		}
 	}
-	mo_graph->addEdges(&edgeset, curr);
+	mo_graph->addEdges(edgeset, curr);
 
 }
 
@@ -1115,18 +1120,17 @@ void ModelExecution::w_modification_order(ModelAction *curr)
  * @return ClockVector of happens before relation.
  */
 
-ClockVector * ModelExecution::get_hb_from_write(ModelAction *rf) const {
-	SnapVector<ModelAction *> * processset = NULL;
+ClockVector * ModelExecution::get_hb_from_write(ModelAction *rf) {
+	SnapVector<ModelAction *> * processset = &scratch_processset;
+	processset->clear();
 	for ( ;rf != NULL;rf = rf->get_reads_from()) {
 		ASSERT(rf->is_write());
 		if (!rf->is_rmw() || (rf->is_acquire() && rf->is_release()) || rf->get_rfcv() != NULL)
 			break;
-		if (processset == NULL)
-			processset = new SnapVector<ModelAction *>();
 		processset->push_back(rf);
 	}
 
-	int i = (processset == NULL) ? 0 : processset->size();
+	int i = processset->size();
 
 	ClockVector * vec = NULL;
 	while(true) {
@@ -1164,8 +1168,6 @@ ClockVector * ModelExecution::get_hb_from_write(ModelAction *rf) const {
 		} else
 			break;
 	}
-	if (processset != NULL)
-		delete processset;
 	return vec;
 }
 
@@ -1179,17 +1181,16 @@ ClockVector * ModelExecution::get_hb_from_write(ModelAction *rf) const {
 void ModelExecution::add_action_to_lists(ModelAction *act, bool canprune)
 {
 	int tid = id_to_int(act->get_tid());
-	if ((act->is_fence() && act->is_seqcst()) || act->is_unlock()) {
-		simple_action_list_t *list = get_safe_ptr_action(&obj_map, act->get_location());
-		act->setActionRef(list->add_back(act));
-	}
+	ObjectState *state = get_obj_state(act);
+	if (act->is_unlock())
+		act->setActionRef(state->actions.add_back(act));
 
 	// Update action trace, a total order of all actions
 	action_trace.addAction(act);
 
 
-	// Update obj_thrd_map, a per location, per thread, order of actions
-	SnapVector<action_list_t> *vec = get_safe_ptr_vect_action(&obj_thrd_map, act->get_location());
+	// Update thrd_actions, a per location, per thread, order of actions
+	SnapVector<action_list_t> *vec = &state->thrd_actions;
 	if ((int)vec->size() <= tid) {
 		uint oldsize = vec->size();
 		vec->resize(priv->next_thread_id);
@@ -1213,9 +1214,20 @@ void ModelExecution::add_action_to_lists(ModelAction *act, bool canprune)
 		thrd_last_fence_release[tid] = act;
 	}
 
+	// Update thrd_sc_fences, the seq_cst fences taken by each thread
+	if (act->is_fence() && act->is_seqcst()) {
+		if ((int)thrd_sc_fences.size() <= tid) {
+			uint oldsize = thrd_sc_fences.size();
+			thrd_sc_fences.resize(priv->next_thread_id);
+			for(uint i = oldsize;i < priv->next_thread_id;i++)
+				new (&thrd_sc_fences[i]) WriteIndex();
+		}
+		thrd_sc_fences[tid].add(act);
+	}
+
 	if (act->is_wait()) {
 		void *mutex_loc = (void *) act->get_value();
-		act->setActionRef(get_safe_ptr_action(&obj_map, mutex_loc)->add_back(act));
+		act->setActionRef(get_obj_state(mutex_loc)->actions.add_back(act));
 	}
 }
 
@@ -1241,8 +1253,8 @@ void ModelExecution::add_normal_write_to_lists(ModelAction *act)
 	int tid = id_to_int(act->get_tid());
 	insertIntoActionListAndSetCV(&action_trace, act);
 
-	// Update obj_thrd_map, a per location, per thread, order of actions
-	SnapVector<action_list_t> *vec = get_safe_ptr_vect_action(&obj_thrd_map, act->get_location());
+	// Update thrd_actions, a per location, per thread, order of actions
+	SnapVector<action_list_t> *vec = &get_obj_state(act)->thrd_actions;
 	if (tid >= (int)vec->size()) {
 		uint oldsize =vec->size();
 		vec->resize(priv->next_thread_id);
@@ -1261,15 +1273,15 @@ void ModelExecution::add_normal_write_to_lists(ModelAction *act)
 
 
 void ModelExecution::add_write_to_lists(ModelAction *write) {
-	SnapVector<simple_action_list_t> *vec = get_safe_ptr_vect_action(&obj_wr_thrd_map, write->get_location());
+	SnapVector<WriteIndex> *vec = &get_obj_state(write)->thrd_writes;
 	int tid = id_to_int(write->get_tid());
 	if (tid >= (int)vec->size()) {
 		uint oldsize =vec->size();
 		vec->resize(priv->next_thread_id);
 		for(uint i=oldsize;i<priv->next_thread_id;i++)
-			new (&(*vec)[i]) simple_action_list_t();
+			new (&(*vec)[i]) WriteIndex();
 	}
-	write->setActionRef((*vec)[tid].add_back(write));
+	(*vec)[tid].add(write);
 }
 
 /**
@@ -1310,13 +1322,14 @@ ModelAction * ModelExecution::get_last_fence_release(thread_id_t tid) const
  */
 ModelAction * ModelExecution::get_last_seq_cst_write(ModelAction *curr) const
 {
-	void *location = curr->get_location();
-	return obj_last_sc_map.get(location);
+	ObjectState *state = find_obj_state(curr);
+	return state != NULL ? state->last_sc_write : NULL;
 }
 
 /**
  * Gets the last memory_order_seq_cst fence (in the total global sequence)
- * performed in a particular thread, prior to a particular fence.
+ * performed in a particular thread, prior to a particular fence.  The
+ * thread's fences are indexed by sequence number, so this is a binary search.
  * @param tid The ID of the thread to check
  * @param before_fence The fence from which to begin the search; if NULL, then
  * search for the most recent fence in the thread.
@@ -1324,29 +1337,14 @@ ModelAction * ModelExecution::get_last_seq_cst_write(ModelAction *curr) const
  */
 ModelAction * ModelExecution::get_last_seq_cst_fence(thread_id_t tid, const ModelAction *before_fence) const
 {
-	/* All fences should have location FENCE_LOCATION */
-	simple_action_list_t *list = obj_map.get(FENCE_LOCATION);
-
-	if (!list)
+	int threadid = id_to_int(tid);
+	if (threadid >= (int)thrd_sc_fences.size())
 		return NULL;
 
-	sllnode<ModelAction*>* rit = list->end();
-
-	if (before_fence) {
-		for (;rit != NULL;rit=rit->getPrev())
-			if (rit->getVal() == before_fence)
-				break;
-
-		ASSERT(rit->getVal() == before_fence);
-		rit=rit->getPrev();
-	}
-
-	for (;rit != NULL;rit=rit->getPrev()) {
-		ModelAction *act = rit->getVal();
-		if (act->is_fence() && (tid == act->get_tid()) && act->is_seqcst())
-			return act;
-	}
-	return NULL;
+	const WriteIndex *index = &thrd_sc_fences.at(threadid);
+	modelclock_t clock = before_fence != NULL ? before_fence->get_seq_number() - 1 : UINT_MAX;
+	int last = index->lastLiveBefore(clock);
+	return last >= 0 ? index->get(last) : NULL;
 }
 
 /**
@@ -1359,11 +1357,10 @@ ModelAction * ModelExecution::get_last_seq_cst_fence(thread_id_t tid, const Mode
  */
 ModelAction * ModelExecution::get_last_unlock(ModelAction *curr) const
 {
-	void *location = curr->get_location();
-
-	simple_action_list_t *list = obj_map.get(location);
-	if (list == NULL)
+	ObjectState *state = find_obj_state(curr);
+	if (state == NULL)
 		return NULL;
+	simple_action_list_t *list = &state->actions;
 
 	/* Find: max({i in dom(S) | isUnlock(t_i) && samevar(t_i, t)}) */
 	sllnode<ModelAction*>* rit;
@@ -1408,16 +1405,35 @@ bool valequals(uint64_t val1, uint64_t val2, int size) {
 	}
 }
 
+/**
+ * @brief Checks that a read does not make a second RMW read from a write
+ * @param curr The read
+ * @param index The index holding the write
+ * @param entry The entry of the write in index
+ * @return False if curr is an RMW that would read from a write another RMW
+ * already reads from
+ */
+static bool rmw_may_read_from(const ModelAction *curr, const WriteIndex *index, int entry)
+{
+	if (!curr->is_rmwr())
+		return true;
+	/* It is okay if we have a failing CAS */
+	if (curr->is_rmwrcas() && !valequals(curr->get_value(), index->get(entry)->get_value(), curr->getSize()))
+		return true;
+	return !index->isRMWConsumed(entry);
+}
+
 /**
  * Build up an initial set of all past writes that this 'read' action may read
  * from, as well as any previously-observed future values that must still be valid.
  *
  * @param curr is the current ModelAction that we are exploring; it must be a
  * 'read' operation.
+ * @param rf_set is filled with the writes; it is cleared first
  */
-SnapVector<ModelAction *> *  ModelExecution::build_may_read_from(ModelAction *curr)
+void ModelExecution::build_may_read_from(ModelAction *curr, SnapVector<ModelAction *> *rf_set)
 {
-	SnapVector<simple_action_list_t> *thrd_lists = obj_wr_thrd_map.get(curr->get_location());
+	SnapVector<WriteIndex> *thrd_lists = &get_obj_state(curr)->thrd_writes;
 	unsigned int i;
 	ASSERT(curr->is_read());
 
@@ -1426,48 +1442,49 @@ SnapVector<ModelAction *> *  ModelExecution::build_may_read_from(ModelAction *cu
 	if (curr->is_seqcst())
 		last_sc_write = get_last_seq_cst_write(curr);
 
-	SnapVector<ModelAction *> * rf_set = new SnapVector<ModelAction *>();
+	rf_set->clear();
+
+	/* Only a failing CAS may read from a write another RMW reads from, so
+	 * other RMWs skip those writes */
+	bool skipconsumed = curr->is_rmwr() && !curr->is_rmwrcas();
 
 	/* Iterate over all threads */
 	if (thrd_lists != NULL)
 		for (i = 0;i < thrd_lists->size();i++) {
-			/* Iterate over actions in thread, starting from most recent */
-			simple_action_list_t *list = &(*thrd_lists)[i];
-			sllnode<ModelAction *> * rit;
-			for (rit = list->end();rit != NULL;rit=rit->getPrev()) {
-				ModelAction *act = rit->getVal();
+			WriteIndex *index = &(*thrd_lists)[i];
+			thread_id_t tid = int_to_id(i);
+
+			/* Include at most one act per-thread that "happens before" curr */
+			int first = index->lastLiveBefore(curr->get_cv()->getClock(tid));
+			if (first < 0)
+				first = 0;
+			/* Acts up to lastsc happen before last_sc_write */
+			int lastsc = last_sc_write != NULL ? index->lastBefore(last_sc_write->get_cv()->getClock(tid)) : -1;
+
+			/* Iterate over writes in thread, starting from most recent */
+			for (int j = index->size() - 1;j >= first;j--) {
+				if (skipconsumed && (j = index->prevReadableByRMW(j)) < first)
+					break;
+				ModelAction *act = index->get(j);
 
-				if (act == curr)
+				if (act == NULL || act == curr)
 					continue;
 
-				/* Don't consider more than one seq_cst write if we are a seq_cst read. */
-				bool allow_read = true;
-
-				if (curr->is_seqcst() && (act->is_seqcst() || (last_sc_write != NULL && act->happens_before(last_sc_write))) && act != last_sc_write)
-					allow_read = false;
-
-				/* Need to check whether we will have two RMW reading from the same value */
-				if (curr->is_rmwr()) {
-					/* It is okay if we have a failing CAS */
-					if (!curr->is_rmwrcas() ||
-							valequals(curr->get_value(), act->get_value(), curr->getSize())) {
-						//Need to make sure we aren't the second RMW
-						CycleNode * node = mo_graph->getNode_noCreate(act);
-						if (node != NULL && node->getRMW() != NULL) {
-							//we are the second RMW
-							allow_read = false;
-						}
-					}
+				if (j <= lastsc) {
+					/* Don't consider more than one seq_cst write if we are a
+					 * seq_cst read: of the rest, only last_sc_write itself */
+					int k = last_sc_write->get_tid() == tid ? index->find(last_sc_write) : -1;
+					if (k >= first && k <= j && rmw_may_read_from(curr, index, k))
+						rf_set->push_back(last_sc_write);
+					break;
 				}
 
-				if (allow_read) {
-					/* Only add feasible reads */
-					rf_set->push_back(act);
-				}
+				if (curr->is_seqcst() && act->is_seqcst() && act != last_sc_write)
+					continue;
 
-				/* Include at most one act per-thread that "happens before" curr */
-				if (act->happens_before(curr))
-					break;
+				/* Only add feasible reads */
+				if (rmw_may_read_from(curr, index, j))
+					rf_set->push_back(act);
 			}
 		}
 
@@ -1476,7 +1493,6 @@ SnapVector<ModelAction *> *  ModelExecution::build_may_read_from(ModelAction *cu
 		curr->print();
 		model_print("End printing read_from_past\n");
 	}
-	return rf_set;
 }
 
 static void print_list(action_list_t *list)
@@ -1730,32 +1746,32 @@ void ModelExecution::removeAction(ModelAction *act) {
 		action_trace.removeAction(act);
 	}
 	{
-		SnapVector<action_list_t> *vec = get_safe_ptr_vect_action(&obj_thrd_map, act->get_location());
+		SnapVector<action_list_t> *vec = &get_obj_state(act)->thrd_actions;
 		(*vec)[act->get_tid()].removeAction(act);
 	}
-	if ((act->is_fence() && act->is_seqcst()) || act->is_unlock()) {
+	if (act->is_fence() && act->is_seqcst()) {
+		thrd_sc_fences[id_to_int(act->get_tid())].remove(act);
+	} else if (act->is_unlock()) {
 		sllnode<ModelAction *> * listref = act->getActionRef();
 		if (listref != NULL) {
-			simple_action_list_t *list = get_safe_ptr_action(&obj_map, act->get_location());
-			list->erase(listref);
+			get_obj_state(act)->actions.erase(listref);
 		}
 	} else if (act->is_wait()) {
 		sllnode<ModelAction *> * listref = act->getActionRef();
 		if (listref != NULL) {
 			void *mutex_loc = (void *) act->get_value();
-			get_safe_ptr_action(&obj_map, mutex_loc)->erase(listref);
+			get_obj_state(mutex_loc)->actions.erase(listref);
 		}
 	} else if (act->is_free()) {
-		sllnode<ModelAction *> * listref = act->getActionRef();
-		if (listref != NULL) {
-			SnapVector<simple_action_list_t> *vec = get_safe_ptr_vect_action(&obj_wr_thrd_map, act->get_location());
-			(*vec)[act->get_tid()].erase(listref);
-		}
-
-		//Clear it from last_sc_map
-		if (obj_last_sc_map.get(act->get_location()) == act) {
-			obj_last_sc_map.remove(act->get_location());
-		}
+		ObjectState *state = get_obj_state(act);
+		SnapVector<WriteIndex> *vec = &state->thrd_writes;
+		int tid = id_to_int(act->get_tid());
+		if (tid < (int)vec->size())
+			(*vec)[tid].remove(act);
+
+		//Clear it from the last seq_cst write
+		if (state->last_sc_write == act)
+			state->last_sc_write = NULL;
 
 		//Remove from Cyclegraph
 		mo_graph->freeAction(act);
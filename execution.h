@@ -18,6 +18,7 @@
 #include "mutex.h"
 #include <condition_variable>
 #include "classlist.h"
+#include "writeindex.h"
 
 struct PendingFutureValue {
 	PendingFutureValue(ModelAction *writer, ModelAction *reader) :
@@ -27,6 +28,31 @@ struct PendingFutureValue {
 	ModelAction *reader;
 };
 
+/**
+ * @brief Everything the execution keeps about one object (i.e., memory
+ * location), found by a single lookup
+ *
+ * Actions cache a pointer to the state of their location.
+ */
+struct ObjectState {
+	ObjectState() :
+		last_sc_write(NULL)
+	{ }
+
+	/** @brief Trace of the unlocks and waits on the object */
+	simple_action_list_t actions;
+	/** @brief Threads waiting on the object as a condition variable */
+	simple_action_list_t waiters;
+	/** @brief List of actions on the object that each thread performed */
+	SnapVector<action_list_t> thrd_actions;
+	/** @brief Index of writes to the object that each thread performed */
+	SnapVector<WriteIndex> thrd_writes;
+	/** @brief The last seq_cst write to the object */
+	ModelAction *last_sc_write;
+
+	SNAPSHOTALLOC
+};
+
 #ifdef COLLECT_STAT
 void print_atomic_accesses();
 #endif
@@ -111,6 +137,9 @@ private:
 	void process_thread_action(ModelAction *curr);
 	void read_from(ModelAction *act, ModelAction *rf);
 	bool synchronize(const ModelAction *first, ModelAction *second);
+	ObjectState * get_obj_state(const void *location);
+	ObjectState * get_obj_state(ModelAction *act);
+	ObjectState * find_obj_state(const ModelAction *act) const;
 	void add_action_to_lists(ModelAction *act, bool canprune);
 	void add_normal_write_to_lists(ModelAction *act);
 	void add_write_to_lists(ModelAction *act);
@@ -118,11 +147,11 @@ private:
 	ModelAction * get_last_seq_cst_write(ModelAction *curr) const;
 	ModelAction * get_last_seq_cst_fence(thread_id_t tid, const ModelAction *before_fence) const;
 	ModelAction * get_last_unlock(ModelAction *curr) const;
-	SnapVector<ModelAction *> * build_may_read_from(ModelAction *curr);
+	void build_may_read_from(ModelAction *curr, SnapVector<ModelAction *> *rf_set);
 	ModelAction * process_rmw(ModelAction *curr);
 	bool r_modification_order(ModelAction *curr, const ModelAction *rf, SnapVector<ModelAction *> *priorset, bool *canprune);
 	void w_modification_order(ModelAction *curr);
-	ClockVector * get_hb_from_write(ModelAction *rf) const;
+	ClockVector * get_hb_from_write(ModelAction *rf);
 	ModelAction * convertNonAtomicStore(void*);
 	ClockVector * computeMinimalCV();
 	void removeAction(ModelAction *act);
@@ -145,23 +174,9 @@ private:
 	action_list_t action_trace;
 
 
-	/** Per-object list of actions. Maps an object (i.e., memory location)
-	 * to a trace of all actions performed on the object.
-	 * Used only for SC fences, unlocks, & wait.
-	 */
-	HashTable<const void *, simple_action_list_t *, uintptr_t, 2> obj_map;
-
-	/** Per-object list of actions. Maps an object (i.e., memory location)
-	 * to a trace of all actions performed on the object. */
-	HashTable<const void *, simple_action_list_t *, uintptr_t, 2> condvar_waiters_map;
-
-	/** Per-object list of actions that each thread performed. */
-	HashTable<const void *, SnapVector<action_list_t> *, uintptr_t, 2> obj_thrd_map;
-
-	/** Per-object list of writes that each thread performed. */
-	HashTable<const void *, SnapVector<simple_action_list_t> *, uintptr_t, 2> obj_wr_thrd_map;
-
-	HashTable<const void *, ModelAction *, uintptr_t, 4> obj_last_sc_map;
+	/** Per-object state. Maps an object (i.e., memory location) to its
+	 * action lists, write index and last seq_cst write. */
+	HashTable<const void *, ObjectState *, uintptr_t, 2> obj_states;
 
 
 	HashTable<pthread_mutex_t *, cdsc::snapmutex *, uintptr_t, 4> mutex_map;
@@ -177,6 +192,16 @@ private:
 	SnapVector<ModelAction *> thrd_last_action;
 	SnapVector<ModelAction *> thrd_last_fence_release;
 
+	/** Per-thread index of the seq_cst fences each thread performed */
+	SnapVector<WriteIndex> thrd_sc_fences;
+
+	/** Scratch sets of the read and write paths, cleared and reused by
+	 *  each action so that they do not allocate once they have grown */
+	SnapVector<ModelAction *> scratch_rf_set;
+	SnapVector<ModelAction *> scratch_priorset;
+	SnapVector<ModelAction *> scratch_edgeset;
+	SnapVector<ModelAction *> scratch_processset;
+
 	/** A special model-checker Thread; used for associating with
 	 *  model-checker-related ModelAcitons */
 	Thread *model_thread;
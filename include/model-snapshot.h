@@ -0,0 +1,27 @@
+#ifndef __MODEL_SNAPSHOT_H__
+#define __MODEL_SNAPSHOT_H__
+
+#if __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Mark the point every later execution restarts from
+ *
+ * By default each execution reruns the program from the start.  After this
+ * call, executions are rolled back to this point instead, so deterministic
+ * setup before it (parsing input, building large data structures) only runs
+ * once.
+ *
+ * Call it from the main thread, before any other thread is created.  If
+ * other threads are already running, the call prints "Ignoring snapshot
+ * point: other threads are already running" and has no effect.  Only the
+ * first call of a run counts; later calls are ignored.
+ */
+void model_snapshot_point();
+
+#if __cplusplus
+}
+#endif
+
+#endif	/* __MODEL_SNAPSHOT_H__ */
@@ -1,4 +1,5 @@
 #include <cdsannotate.h>
+#include <model-snapshot.h>
 #include "common.h"
 #include "action.h"
 #include "model.h"
@@ -12,3 +13,11 @@ void cdsannotate(uint64_t analysistype, void *annotation) {
 	/* seq_cst is just a 'don't care' parameter */
 	model->switch_thread(new ModelAction(ATOMIC_ANNOTATION, std::memory_order_seq_cst, annotation, analysistype));
 }
+
+/** Mark the point the model checker should restart every later execution
+ *  from.  Call it while the main thread is the only thread, after
+ *  deterministic program setup. */
+void model_snapshot_point() {
+	createModelIfNotExist();
+	model->take_prefix_snapshot();
+}
@@ -12,7 +12,8 @@ void store_8(void *addr, uint8_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu8 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
+	racesite = __builtin_return_address(0);
+	raceCheckWrite8(tid, addr);
 	(*(uint8_t *)addr) = val;
 }
 
@@ -20,8 +21,8 @@ void store_16(void *addr, uint16_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu16 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 1));
+	racesite = __builtin_return_address(0);
+	raceCheckWrite16(tid, addr);
 	(*(uint16_t *)addr) = val;
 }
 
@@ -29,10 +30,8 @@ void store_32(void *addr, uint32_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu32 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 1));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 2));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 3));
+	racesite = __builtin_return_address(0);
+	raceCheckWrite32(tid, addr);
 	(*(uint32_t *)addr) = val;
 }
 
@@ -40,14 +39,8 @@ void store_64(void *addr, uint64_t val)
 {
 	DEBUG("addr = %p, val = %" PRIu64 "\n", addr, val);
 	thread_id_t tid = thread_current_id();
-	raceCheckWrite(tid, addr);
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 1));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 2));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 3));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 4));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 5));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 6));
-	raceCheckWrite(tid, (void *)(((uintptr_t)addr) + 7));
+	racesite = __builtin_return_address(0);
+	raceCheckWrite64(tid, addr);
 	(*(uint64_t *)addr) = val;
 }
 
@@ -55,7 +48,8 @@ uint8_t load_8(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
+	racesite = __builtin_return_address(0);
+	raceCheckRead8(tid, addr);
 	return *((uint8_t *)addr);
 }
 
@@ -63,8 +57,8 @@ uint16_t load_16(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 1));
+	racesite = __builtin_return_address(0);
+	raceCheckRead16(tid, addr);
 	return *((uint16_t *)addr);
 }
 
@@ -72,10 +66,8 @@ uint32_t load_32(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 1));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 2));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 3));
+	racesite = __builtin_return_address(0);
+	raceCheckRead32(tid, addr);
 	return *((uint32_t *)addr);
 }
 
@@ -83,14 +75,8 @@ uint64_t load_64(const void *addr)
 {
 	DEBUG("addr = %p\n", addr);
 	thread_id_t tid = thread_current_id();
-	raceCheckRead(tid, addr);
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 1));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 2));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 3));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 4));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 5));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 6));
-	raceCheckRead(tid, (const void *)(((uintptr_t)addr) + 7));
+	racesite = __builtin_return_address(0);
+	raceCheckRead64(tid, addr);
 	return *((uint64_t *)addr);
 }
 
@@ -107,6 +93,7 @@ void cds_store8(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckWrite8(tid, addr);
 }
 
@@ -116,6 +103,7 @@ void cds_store16(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckWrite16(tid, addr);
 }
 
@@ -125,6 +113,7 @@ void cds_store32(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckWrite32(tid, addr);
 }
 
@@ -134,6 +123,7 @@ void cds_store64(void *addr)
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckWrite64(tid, addr);
 }
 
@@ -141,6 +131,7 @@ void cds_load8(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckRead8(tid, addr);
 }
 
@@ -148,6 +139,7 @@ void cds_load16(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckRead16(tid, addr);
 }
 
@@ -155,6 +147,7 @@ void cds_load32(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckRead32(tid, addr);
 }
 
@@ -162,5 +155,6 @@ void cds_load64(const void *addr) {
 	if (!model)
 		return;
 	thread_id_t tid = thread_current_id();
+	racesite = __builtin_return_address(0);
 	raceCheckRead64(tid, addr);
 }
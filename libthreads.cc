@@ -12,6 +12,9 @@
  */
 int thrd_create(thrd_t *t, thrd_start_t start_routine, void *arg)
 {
+	if (model->params.prefixsnapshot)
+		model->take_prefix_snapshot();
+	noteStackEscape(thread_current_id(), (uintptr_t)arg);
 	struct thread_params params = { start_routine, arg };
 	/* seq_cst is just a 'don't care' parameter */
 	model->switch_thread(new ModelAction(THREAD_CREATE, std::memory_order_seq_cst, t, (uint64_t)&params));
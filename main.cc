@@ -14,7 +14,7 @@
 /* global "model" object */
 #include "model.h"
 #include "params.h"
-#include "snapshot-interface.h"
+#include "snapshot.h"
 #include "plugins.h"
 
 void param_defaults(struct model_params *params)
@@ -25,6 +25,13 @@ void param_defaults(struct model_params *params)
 	params->checkthreshold = 500000;
 	params->removevisible = false;
 	params->nofork = false;
+	params->numprocs = 1;
+	params->standby = false;
+	params->prefixsnapshot = false;
+	params->racesample = 0;
+	params->sampleperiod = 1024;
+	params->stackfilter = 0;
+	params->racestats = false;
 }
 
 static void print_usage(struct model_params *params)
@@ -54,7 +61,15 @@ static void print_usage(struct model_params *params)
 		"-x, --maxexec=NUM           Maximum number of executions.\n"
 		"                            Default: %u\n"
 		"                            -o help for a list of options\n"
-		"-n                          No fork\n"
+		"-n                          No fork: roll executions back in-process\n"
+		"-j, --jobs=NUM              Number of executions to run in parallel, each in\n"
+		"                            its own forked process.\n"
+		"                            Default: %d\n"
+		"-s, --standby               Fork the process for the next execution while the\n"
+		"                            current one runs, to hide the fork latency.\n"
+		"-p, --prefix                Take the rollback snapshot at the first thread\n"
+		"                            creation, so later executions skip the program's\n"
+		"                            single-threaded start.\n"
 		"-m, --minsize=NUM           Minimum number of actions to keep\n"
 		"                            Default: %u\n"
 		"-f, --freqfree=NUM          Frequency to free actions\n"
@@ -62,8 +77,44 @@ static void print_usage(struct model_params *params)
 		"-r, --removevisible         Free visible writes\n",
 		params->verbose,
 		params->maxexecutions,
+		params->numprocs,
 		params->traceminsize,
 		params->checkthreshold);
+	model_print(
+		"-S, --sample=NUM            Sample the race checks of a location once it has\n"
+		"                            been race-free in NUM executions, checking fewer\n"
+		"                            of its accesses with each further execution.\n"
+		"                            Default: %u (check every access)\n"
+		"--samplerate=NUM            Lowest sampling rate: one check in NUM accesses.\n"
+		"                            Default: %u\n"
+		"--stackfilter[=NUM]         Skip the race checks of a thread's accesses to its\n"
+		"                            own stack. NUM is optional:\n"
+		"                              1 checks a stack again once a pointer into it is\n"
+		"                              stored atomically or passed to a new thread;\n"
+		"                              2 never checks own stacks.\n"
+		"                            Default: %d\n"
+		"--racestats                 Print the race detector's counters at the end of\n"
+		"                            the run (verbose runs print them too), also as a\n"
+		"                            RACESTATS line of JSON, and the counters of each\n"
+		"                            execution as a RACESTATS_EXECUTION line.\n",
+		params->racesample,
+		params->sampleperiod,
+		params->stackfilter);
+	model_print(
+		"--sharedmem=MB              Size of the shared (non-snapshot) memory heap.\n"
+		"                            Default: %zu\n"
+		"--sharedstack=MB            Size of the shared stack.\n"
+		"                            Default: %zu\n"
+		"--snapshotmem=MB            Size of the snapshot heap.\n"
+		"                            Default: %zu\n"
+		"--hugepages[=NUM]           Back the snapshot heap (including shadow tables\n"
+		"                            and thread stacks) with huge pages, so forks copy\n"
+		"                            fewer page table entries. NUM is optional:\n"
+		"                              1 is transparent huge pages; 2 is explicit\n"
+		"                              (hugetlbfs) huge pages.\n",
+		SHARED_MEMORY_DEFAULT >> 20,
+		STACK_SIZE_DEFAULT >> 20,
+		(size_t)SNAPSHOT_HEAP_PAGES * PAGESIZE >> 20);
 	model_print("Analysis plugins:\n");
 	for(unsigned int i=0;i<registeredanalysis->size();i++) {
 		TraceAnalysis * analysis=(*registeredanalysis)[i];
@@ -88,16 +139,29 @@ bool install_plugin(char * name) {
 }
 
 void parse_options(struct model_params *params) {
-	const char *shortopts = "hrnt:o:x:v:m:f:";
+	const char *shortopts = "hrnspj:t:o:x:v:m:f:S:";
 	const struct option longopts[] = {
 		{"help", no_argument, NULL, 'h'},
 		{"removevisible", no_argument, NULL, 'r'},
 		{"analysis", required_argument, NULL, 't'},
 		{"options", required_argument, NULL, 'o'},
 		{"maxexecutions", required_argument, NULL, 'x'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"standby", no_argument, NULL, 's'},
+		{"prefix", no_argument, NULL, 'p'},
 		{"verbose", optional_argument, NULL, 'v'},
 		{"minsize", required_argument, NULL, 'm'},
 		{"freqfree", required_argument, NULL, 'f'},
+		{"sample", required_argument, NULL, 'S'},
+		{"samplerate", required_argument, NULL, 'R'},
+		{"stackfilter", optional_argument, NULL, 'F'},
+		{"racestats", no_argument, NULL, 'D'},
+		/* Read by the snapshot system, which sets up memory before the
+		 * options are parsed; checked here too, to report bad values */
+		{"sharedmem", required_argument, NULL, 'M'},
+		{"sharedstack", required_argument, NULL, 'K'},
+		{"snapshotmem", required_argument, NULL, 'N'},
+		{"hugepages", optional_argument, NULL, 'H'},
 		{0, 0, 0, 0}	/* Terminator */
 	};
 	int opt, longindex;
@@ -137,6 +201,17 @@ void parse_options(struct model_params *params) {
 		case 'x':
 			params->maxexecutions = atoi(optarg);
 			break;
+		case 'j':
+			params->numprocs = atoi(optarg);
+			if (params->numprocs < 1)
+				error = true;
+			break;
+		case 's':
+			params->standby = true;
+			break;
+		case 'p':
+			params->prefixsnapshot = true;
+			break;
 		case 'v':
 			params->verbose = optarg ? atoi(optarg) : 1;
 			break;
@@ -153,6 +228,42 @@ void parse_options(struct model_params *params) {
 		case 'r':
 			params->removevisible = true;
 			break;
+		case 'S':
+			if (!parse_unsigned(optarg, &params->racesample))
+				error = true;
+			break;
+		case 'R':
+			if (!parse_unsigned(optarg, &params->sampleperiod) || params->sampleperiod < 1)
+				error = true;
+			break;
+		case 'F':
+		{
+			unsigned int mode = 1;
+			if (optarg != NULL && (!parse_unsigned(optarg, &mode) || mode > 2))
+				error = true;
+			params->stackfilter = mode;
+		}
+		break;
+		case 'D':
+			params->racestats = true;
+			break;
+		/* Applied by the snapshot system, with the same checks */
+		case 'M':
+		case 'K':
+		case 'N':
+		{
+			size_t size;
+			if (!snapshot_parse_size(optarg, &size))
+				error = true;
+		}
+		break;
+		case 'H':
+		{
+			int hugepages;
+			if (!snapshot_parse_hugepages(optarg, &hugepages))
+				error = true;
+		}
+		break;
 		case 'o':
 		{
 			ModelVector<TraceAnalysis *> * analyses = getInstalledTraceAnalysis();
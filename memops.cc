@@ -0,0 +1,299 @@
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "model.h"
+#include "datarace.h"
+#include "threads-model.h"
+
+/* Race checks for the bulk memory functions.  Calls made by the program
+ * check the source as a read range and the destination as a write range,
+ * then go on to the C library.  Freeing or unmapping memory resets its
+ * shadow. */
+
+static void * (*memcpy_p)(void *, const void *, size_t) = NULL;
+static void * (*memmove_p)(void *, const void *, size_t) = NULL;
+static void * (*memset_p)(void *, int, size_t) = NULL;
+static char * (*strcpy_p)(char *, const char *) = NULL;
+static char * (*strncpy_p)(char *, const char *, size_t) = NULL;
+static void (*free_p)(void *) = NULL;
+static int (*munmap_p)(void *, size_t) = NULL;
+
+/* Set while the C library functions are looked up, which may itself use
+ * them */
+static bool resolving = false;
+
+/* Executable ranges of the model checker and of the system libraries it
+ * uses: calls from there are not the program's */
+#define MAXRUNTIMERANGES 64
+struct code_range {
+	uintptr_t start;
+	uintptr_t end;
+	/* Part of the model checker itself */
+	bool self;
+};
+static struct code_range runtimeranges[MAXRUNTIMERANGES];
+static int numruntimeranges = -1;
+
+static void real_init_memops()
+{
+	char * error;
+	resolving = true;
+	memcpy_p = (void * (*)(void *, const void *, size_t))dlsym(RTLD_NEXT, "memcpy");
+	memmove_p = (void * (*)(void *, const void *, size_t))dlsym(RTLD_NEXT, "memmove");
+	memset_p = (void * (*)(void *, int, size_t))dlsym(RTLD_NEXT, "memset");
+	strcpy_p = (char * (*)(char *, const char *))dlsym(RTLD_NEXT, "strcpy");
+	strncpy_p = (char * (*)(char *, const char *, size_t))dlsym(RTLD_NEXT, "strncpy");
+	free_p = (void (*)(void *))dlsym(RTLD_NEXT, "free");
+	munmap_p = (int (*)(void *, size_t))dlsym(RTLD_NEXT, "munmap");
+	if ((error = dlerror()) != NULL) {
+		fputs(error, stderr);
+		exit(EXIT_FAILURE);
+	}
+	resolving = false;
+}
+
+/* Plain loops for calls made while resolving; volatile keeps the compiler
+ * from turning them back into library calls. */
+static void * bootstrap_memmove(void *dst, const void *src, size_t n)
+{
+	volatile char *d = (volatile char *)dst;
+	const volatile char *s = (const volatile char *)src;
+	if (d < s)
+		for(size_t i = 0;i < n;i++)
+			d[i] = s[i];
+	else
+		for(size_t i = n;i > 0;i--)
+			d[i - 1] = s[i - 1];
+	return dst;
+}
+
+static void * bootstrap_memset(void *dst, int c, size_t n)
+{
+	volatile char *d = (volatile char *)dst;
+	for(size_t i = 0;i < n;i++)
+		d[i] = (char)c;
+	return dst;
+}
+
+static char * bootstrap_strncpy(char *dst, const char *src, size_t n)
+{
+	volatile char *d = (volatile char *)dst;
+	size_t i = 0;
+	for(;i < n && src[i] != 0;i++)
+		d[i] = src[i];
+	for(;i < n;i++)
+		d[i] = 0;
+	return dst;
+}
+
+static bool is_runtime_library(const char *name)
+{
+	static const char * const prefixes[] = {
+		"libc.so", "libc-", "ld-linux", "ld64", "libstdc++", "libgcc_s", "libm.so",
+		"libdl", "libpthread", "librt", "linux-vdso", NULL
+	};
+	const char *base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	for(int i = 0;prefixes[i] != NULL;i++)
+		if (strncmp(base, prefixes[i], strlen(prefixes[i])) == 0)
+			return true;
+	return false;
+}
+
+static int add_runtime_ranges(struct dl_phdr_info *info, size_t size, void *data)
+{
+	Dl_info *self = (Dl_info *)data;
+	bool isself = (void *)info->dlpi_addr == self->dli_fbase;
+	if (!isself && !is_runtime_library(info->dlpi_name))
+		return 0;
+	for(int i = 0;i < info->dlpi_phnum;i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X) || numruntimeranges == MAXRUNTIMERANGES)
+			continue;
+		runtimeranges[numruntimeranges].start = info->dlpi_addr + phdr->p_vaddr;
+		runtimeranges[numruntimeranges].end = info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz;
+		runtimeranges[numruntimeranges].self = isself;
+		numruntimeranges++;
+	}
+	return 0;
+}
+
+/** @brief Is a call from the model checker, or with anyfromruntime, from
+ *  the system libraries it uses? */
+static bool from_runtime(void *caller, bool anyfromruntime)
+{
+	if (numruntimeranges < 0) {
+		Dl_info self;
+		numruntimeranges = 0;
+		if (dladdr((void *)&from_runtime, &self))
+			dl_iterate_phdr(add_runtime_ranges, &self);
+	}
+	uintptr_t pc = (uintptr_t)caller;
+	for(int i = 0;i < numruntimeranges;i++)
+		if (pc >= runtimeranges[i].start && pc < runtimeranges[i].end)
+			return anyfromruntime || runtimeranges[i].self;
+	return false;
+}
+
+/** @brief Is a call to a memory function from the program, in one of its
+ *  threads, while the model checker runs? */
+static bool check_call(void *caller)
+{
+	if (model == NULL || resolving)
+		return false;
+	if (from_runtime(caller, true))
+		return false;
+	return thread_current() != NULL;
+}
+
+void * memcpy(void *dst, const void *src, size_t n)
+{
+	if (!memcpy_p) {
+		if (resolving)
+			return bootstrap_memmove(dst, src, n);
+		real_init_memops();
+	}
+	if (n != 0 && check_call(__builtin_return_address(0))) {
+		thread_id_t tid = thread_current_id();
+		racesite = __builtin_return_address(0);
+		raceCheckRange(tid, src, n, false);
+		raceCheckRange(tid, dst, n, true);
+	}
+	return memcpy_p(dst, src, n);
+}
+
+void * memmove(void *dst, const void *src, size_t n)
+{
+	if (!memmove_p) {
+		if (resolving)
+			return bootstrap_memmove(dst, src, n);
+		real_init_memops();
+	}
+	if (n != 0 && check_call(__builtin_return_address(0))) {
+		thread_id_t tid = thread_current_id();
+		racesite = __builtin_return_address(0);
+		raceCheckRange(tid, src, n, false);
+		raceCheckRange(tid, dst, n, true);
+	}
+	return memmove_p(dst, src, n);
+}
+
+void * memset(void *dst, int c, size_t n)
+{
+	if (!memset_p) {
+		if (resolving)
+			return bootstrap_memset(dst, c, n);
+		real_init_memops();
+	}
+	if (n != 0 && check_call(__builtin_return_address(0))) {
+		racesite = __builtin_return_address(0);
+		raceCheckRange(thread_current_id(), dst, n, true);
+	}
+	return memset_p(dst, c, n);
+}
+
+/* The model checker's own calls to memcpy, memmove and memset, including
+ * the ones the compiler emits, are linked to these instead (--wrap in the
+ * Makefile): they go straight to the C library, without the caller lookup
+ * of the versions above. */
+extern "C" {
+void * __wrap_memcpy(void *dst, const void *src, size_t n) __attribute__((visibility("hidden")));
+void * __wrap_memmove(void *dst, const void *src, size_t n) __attribute__((visibility("hidden")));
+void * __wrap_memset(void *dst, int c, size_t n) __attribute__((visibility("hidden")));
+}
+
+void * __wrap_memcpy(void *dst, const void *src, size_t n)
+{
+	if (!memcpy_p) {
+		if (resolving)
+			return bootstrap_memmove(dst, src, n);
+		real_init_memops();
+	}
+	return memcpy_p(dst, src, n);
+}
+
+void * __wrap_memmove(void *dst, const void *src, size_t n)
+{
+	if (!memmove_p) {
+		if (resolving)
+			return bootstrap_memmove(dst, src, n);
+		real_init_memops();
+	}
+	return memmove_p(dst, src, n);
+}
+
+void * __wrap_memset(void *dst, int c, size_t n)
+{
+	if (!memset_p) {
+		if (resolving)
+			return bootstrap_memset(dst, c, n);
+		real_init_memops();
+	}
+	return memset_p(dst, c, n);
+}
+
+char * strcpy(char *dst, const char *src)
+{
+	if (!strcpy_p) {
+		if (resolving)
+			return bootstrap_strncpy(dst, src, strlen(src) + 1);
+		real_init_memops();
+	}
+	if (check_call(__builtin_return_address(0))) {
+		thread_id_t tid = thread_current_id();
+		racesite = __builtin_return_address(0);
+		size_t n = strlen(src) + 1;
+		raceCheckRange(tid, src, n, false);
+		raceCheckRange(tid, dst, n, true);
+	}
+	return strcpy_p(dst, src);
+}
+
+char * strncpy(char *dst, const char *src, size_t n)
+{
+	if (!strncpy_p) {
+		if (resolving)
+			return bootstrap_strncpy(dst, src, n);
+		real_init_memops();
+	}
+	if (n != 0 && check_call(__builtin_return_address(0))) {
+		thread_id_t tid = thread_current_id();
+		racesite = __builtin_return_address(0);
+		size_t len = strnlen(src, n);
+		raceCheckRange(tid, src, len < n ? len + 1 : n, false);
+		raceCheckRange(tid, dst, n, true);
+	}
+	return strncpy_p(dst, src, n);
+}
+
+/* Blocks freed by the C++ runtime's operator delete come through here too,
+ * so only the model checker's own calls are left alone. */
+void free(void *ptr)
+{
+	if (!free_p) {
+		if (resolving)
+			return;	/* Leaked */
+		real_init_memops();
+	}
+	if (ptr != NULL && model != NULL && !resolving && !from_runtime(__builtin_return_address(0), false))
+		resetShadowRange(ptr, malloc_usable_size(ptr));
+	free_p(ptr);
+}
+
+int munmap(void *addr, size_t length)
+{
+	if (!munmap_p) {
+		if (resolving)
+			return 0;
+		real_init_memops();
+	}
+	if (check_call(__builtin_return_address(0)))
+		resetShadowRange(addr, length);
+	return munmap_p(addr, length);
+}
@@ -8,9 +8,10 @@
 #include "model.h"
 #include "action.h"
 #include "schedule.h"
-#include "snapshot-interface.h"
+#include "snapshot.h"
 #include "common.h"
 #include "datarace.h"
+#include "clockvector.h"
 #include "threads-model.h"
 #include "output.h"
 #include "traceanalysis.h"
@@ -31,6 +32,9 @@ void placeholder(void *) {
 #define SIGSTACKSIZE 65536
 static void mprot_handle_pf(int sig, siginfo_t *si, void *unused)
 {
+	/* A write to a page the in-process snapshots write-protected */
+	if (snapshot_handle_fault(si->si_addr))
+		return;
 	model_print("Segmentation fault at %p\n", si->si_addr);
 	model_print("For debugging, place breakpoint at: %s:%d\n",
 							__FILE__, __LINE__);
@@ -58,8 +62,11 @@ void install_handler() {
 
 void createModelIfNotExist() {
 	if (!model) {
-		snapshot_system_init(100000);
+		snapshot_system_init(SNAPSHOT_HEAP_PAGES);
+		initClockVectors();
 		model = new ModelChecker();
+		/* Needs the parsed options, through model */
+		initRaceDetector();
 		model->startChecker();
 	}
 }
@@ -72,6 +79,8 @@ ModelChecker::ModelChecker() :
 	history(new ModelHistory()),
 	execution(new ModelExecution(this, scheduler)),
 	execution_number(1),
+	parallel_worker(false),
+	prefix_snapshot_taken(false),
 	curr_thread_num(1),
 	trace_analyses(),
 	inspect_plugin(NULL)
@@ -81,6 +90,7 @@ ModelChecker::ModelChecker() :
 							"Distributed under the GPLv2\n"
 							"Written by Weiyu Luo, Brian Norris, and Brian Demsky\n\n");
 	memset(&stats,0,sizeof(struct execution_stats));
+	memset(&execrace,0,sizeof(struct race_stats));
 	init_thread = new Thread(execution->get_next_id(), (thrd_t *) model_malloc(sizeof(thrd_t)), &placeholder, NULL, NULL);
 #ifdef TLS
 	init_thread->setTLS((char *)get_tls_addr());
@@ -91,7 +101,6 @@ ModelChecker::ModelChecker() :
 	execution->setParams(&params);
 	param_defaults(&params);
 	parse_options(&params);
-	initRaceDetector();
 	/* Configure output redirection for the model-checker */
 	install_handler();
 }
@@ -232,9 +241,21 @@ void ModelChecker::print_bugs() const
 void ModelChecker::record_stats()
 {
 	stats.num_total ++;
-	if (execution->have_bug_reports())
+	/* The totals recorded at the end of the previous execution are the
+	 * counters at the start of this one */
+	struct race_stats race;
+	getRaceStats(&race);
+	diffRaceStats(&execrace, &race, &stats.race);
+	stats.race = race;
+	if (execution->have_bug_reports()) {
 		stats.num_buggy_executions ++;
-	else if (execution->is_complete_execution())
+		/* A parallel run lists the bugs of all workers together */
+		if (parallel_worker) {
+			SnapVector<bug_message *> *bugs = execution->get_bugs();
+			for (unsigned int i = 0;i < bugs->size();i++)
+				snapshot_merge_bug((*bugs)[i]->msg);
+		}
+	} else if (execution->is_complete_execution())
 		stats.num_complete ++;
 	else {
 		//All threads are sleeping
@@ -253,6 +274,11 @@ void ModelChecker::print_stats() const
 	model_print("Number of complete, bug-free executions: %d\n", stats.num_complete);
 	model_print("Number of buggy executions: %d\n", stats.num_buggy_executions);
 	model_print("Total executions: %d\n", stats.num_total);
+	if (stats.num_memory_actions != 0)
+		model_print("Snapshot heap allocations per atomic read or write: %.2f (over %" PRIu64 " actions)\n",
+								(double)stats.num_memory_action_allocs / stats.num_memory_actions, stats.num_memory_actions);
+	if (params.racestats || params.verbose)
+		printRaceStats(&stats.race, stats.num_total, params.racestats);
 }
 
 /**
@@ -268,6 +294,8 @@ void ModelChecker::print_execution(bool printbugs) const
 	if (params.verbose >= 3) {
 		print_stats();
 	}
+	if (params.verbose)
+		printExecutionRaceStats(&execrace, get_execution_number(), false);
 
 	/* Don't print invalid bugs */
 	if (printbugs && execution->have_bug_reports()) {
@@ -280,13 +308,13 @@ void ModelChecker::print_execution(bool printbugs) const
 }
 
 /**
- * Queries the model-checker for more executions to explore and, if one
- * exists, resets the model-checker state to execute a new execution.
+ * Finishes the current execution and, if there are more executions to
+ * explore, resets the model-checker state to execute the next one.
  *
- * @return If there are more executions to explore, return true. Otherwise,
- * return false.
+ * @param next_execution The number of the next execution; there is none if
+ * it is past params.maxexecutions
  */
-void ModelChecker::finish_execution(bool more_executions)
+void ModelChecker::finish_execution(int next_execution)
 {
 	DBG();
 	/* Is this execution a feasible execution that's worth bug-checking? */
@@ -307,11 +335,13 @@ void ModelChecker::finish_execution(bool more_executions)
 		print_execution(complete);
 	else
 		clear_program_output();
+	if (params.racestats)
+		printExecutionRaceStats(&execrace, get_execution_number(), true);
 
-	execution_number ++;
+	execution_number = next_execution;
 	history->set_new_exec_flag();
 
-	if (more_executions)
+	if (next_execution <= params.maxexecutions)
 		reset_to_initial_state();
 }
 
@@ -420,12 +450,19 @@ void ModelChecker::finishRunExecution(Thread *old)
 	curr_thread_num = 1;
 
 	/** If we have more executions, we won't make it past this call. */
-	finish_execution(execution_number < params.maxexecutions);
+	finish_execution(parallel_worker ? snapshot_claim_execution() : execution_number + 1);
 
 
 	/** We finished the final execution.  Print stuff and exit. */
-	model_print("******* Model-checking complete: *******\n");
-	print_stats();
+	snapshot_finish_execution();
+	if (parallel_worker) {
+		/* The farm process prints the stats of all workers together */
+		snapshot_merge_stats(&stats);
+	} else {
+		model_print("******* Model-checking complete: *******\n");
+		print_stats();
+		snapshot_print_stats();
+	}
 
 	/* Have the trace analyses dump their output. */
 	for (unsigned int i = 0;i < trace_analyses.size();i++)
@@ -506,7 +543,13 @@ bool ModelChecker::handleChosenThread(Thread *old)
 	// Consume the next action for a Thread
 	ModelAction *curr = chosen_thread->get_pending();
 	chosen_thread->set_pending(NULL);
+	bool ismemory = curr->is_read() || curr->is_write();
+	uint64_t allocs = snapshot_heap_allocs;
 	chosen_thread = execution->take_step(curr);
+	if (ismemory) {
+		stats.num_memory_actions++;
+		stats.num_memory_action_allocs += snapshot_heap_allocs - allocs;
+	}
 
 	if (should_terminate_execution()) {
 		finishRunExecution(old);
@@ -516,6 +559,38 @@ bool ModelChecker::handleChosenThread(Thread *old)
 	}
 }
 
+/**
+ * @brief Move the rollback snapshot to the current point of the execution
+ *
+ * Later executions restart from here rather than from the start of the
+ * program, so its deterministic single-threaded prefix only runs once. Only the
+ * first call of a run has an effect, and only while the main thread is the
+ * only user thread.
+ */
+void ModelChecker::take_prefix_snapshot()
+{
+	if (prefix_snapshot_taken)
+		return;
+	prefix_snapshot_taken = true;
+
+	if (get_current_thread() != init_thread || get_num_threads() > 2) {
+		model_print("Ignoring snapshot point: other threads are already running\n");
+		return;
+	}
+
+	/* These live in shared memory, so the snapshot does not restore them */
+	unsigned int thread_num = curr_thread_num;
+	Thread *chosen = chosen_thread;
+
+	fflush(stdout);
+	snapshot = take_snapshot();
+
+	setstate(random_state);
+	curr_thread_num = thread_num;
+	chosen_thread = chosen;
+	reopen_program_output();
+}
+
 void ModelChecker::startChecker() {
 	startExecution();
 	//Need to initial random number generator state to avoid resets on rollback
@@ -531,6 +606,41 @@ void ModelChecker::startChecker() {
 	initMainThread();
 }
 
+/**
+ * @brief Set up this process as one worker of a parallel run
+ *
+ * Called in the worker process right after it has been forked off. The
+ * worker runs first_execution, then claims further executions from the run
+ * as it finishes each one. It has its own random number generator stream.
+ *
+ * @param worker The index of the worker
+ * @param first_execution The number of the first execution to run
+ */
+void ModelChecker::start_parallel_worker(int worker, int first_execution)
+{
+	parallel_worker = true;
+	execution_number = first_execution;
+	initstate(423121 + worker, random_state, sizeof(random_state));
+}
+
+/**
+ * @brief Print the combined bugs and stats of a parallel run and exit
+ * @param totals The stats accumulated over all worker processes
+ * @param failed Whether a worker process crashed or exited with an error;
+ * the run then exits with an error too, as its stats are incomplete
+ */
+void ModelChecker::finish_parallel_run(const struct execution_stats *totals, bool failed)
+{
+	stats = *totals;
+	snapshot_print_bugs();
+	model_print("******* Model-checking complete: *******\n");
+	print_stats();
+	snapshot_print_stats();
+	if (failed)
+		model_print("Some worker processes failed: the stats above are incomplete\n");
+	_Exit(failed ? EXIT_FAILURE : 0);
+}
+
 bool ModelChecker::should_terminate_execution()
 {
 	if (execution->have_bug_reports()) {
@@ -17,12 +17,16 @@
 #include "params.h"
 #include "classlist.h"
 #include "snapshot-interface.h"
+#include "datarace.h"
 
 /** @brief Model checker execution stats */
 struct execution_stats {
 	int num_total;	/**< @brief Total number of executions */
 	int num_buggy_executions;	/** @brief Number of buggy executions */
 	int num_complete;	/**< @brief Number of feasible, non-buggy, complete executions */
+	uint64_t num_memory_actions;	/**< @brief Atomic reads and writes processed */
+	uint64_t num_memory_action_allocs;	/**< @brief Snapshot heap allocations while processing them */
+	struct race_stats race;	/**< @brief Race detector counters */
 };
 
 /** @brief The central structure for model-checking */
@@ -56,6 +60,9 @@ public:
 	void add_trace_analysis(TraceAnalysis *a) {     trace_analyses.push_back(a); }
 	void set_inspect_plugin(TraceAnalysis *a) {     inspect_plugin=a;       }
 	void startChecker();
+	void take_prefix_snapshot();
+	void start_parallel_worker(int worker, int first_execution);
+	void finish_parallel_run(const struct execution_stats *totals, bool failed);
 	Thread * getInitThread() {return init_thread;}
 	Scheduler * getScheduler() {return scheduler;}
 	MEMALLOC
@@ -71,6 +78,12 @@ private:
 
 	int execution_number;
 
+	/** @brief Is this process one of the workers of a parallel run? */
+	bool parallel_worker;
+
+	/** @brief Has the rollback snapshot been moved past the program start? */
+	bool prefix_snapshot_taken;
+
 	unsigned int curr_thread_num;
 	Thread * chosen_thread;
 	bool break_execution;
@@ -84,7 +97,7 @@ private:
 
 	unsigned int get_num_threads() const;
 
-	void finish_execution(bool moreexecutions);
+	void finish_execution(int next_execution);
 	bool should_terminate_execution();
 
 	Thread * get_next_thread();
@@ -97,6 +110,8 @@ private:
 	TraceAnalysis *inspect_plugin;
 	/** @brief The cumulative execution stats */
 	struct execution_stats stats;
+	/** @brief Race detector counters of the last execution alone */
+	struct race_stats execrace;
 	void record_stats();
 	void run_trace_analyses();
 	void print_bugs() const;
@@ -38,9 +38,12 @@ void *model_realloc(void *ptr, size_t size)
 	return mspace_realloc(sStaticSpace, ptr, size);
 }
 
+uint64_t snapshot_heap_allocs = 0;
+
 /** @brief Snapshotting malloc, for use by model-checker (not user progs) */
 void * snapshot_malloc(size_t size)
 {
+	snapshot_heap_allocs++;
 	void *tmp = mspace_malloc(model_snapshot_space, size);
 	ASSERT(tmp);
 	return tmp;
@@ -49,6 +52,7 @@ void * snapshot_malloc(size_t size)
 /** @brief Snapshotting calloc, for use by model-checker (not user progs) */
 void * snapshot_calloc(size_t count, size_t size)
 {
+	snapshot_heap_allocs++;
 	void *tmp = mspace_calloc(model_snapshot_space, count, size);
 	ASSERT(tmp);
 	return tmp;
@@ -57,6 +61,7 @@ void * snapshot_calloc(size_t count, size_t size)
 /** @brief Snapshotting realloc, for use by model-checker (not user progs) */
 void *snapshot_realloc(void *ptr, size_t size)
 {
+	snapshot_heap_allocs++;
 	void *tmp = mspace_realloc(model_snapshot_space, ptr, size);
 	ASSERT(tmp);
 	return tmp;
@@ -68,6 +73,65 @@ void snapshot_free(void *ptr)
 	mspace_free(model_snapshot_space, ptr);
 }
 
+/* The snapshot pool hands out blocks in size classes of POOLGRANULE bytes,
+ * up to POOLCLASSES classes, carved from slabs of POOLSLABBYTES taken from
+ * the snapshotting heap.  Freed blocks go on the free list of their class
+ * and are never given back to the heap.  The free lists and the current
+ * slab are in snapshotted memory, so they roll back with the blocks. */
+#define POOLGRANULE 16
+#define POOLCLASSES 16
+#define POOLSLABBYTES 65536
+
+struct pool_block {
+	struct pool_block *next;
+};
+
+static struct pool_block *poolfreelists[POOLCLASSES];
+static char *poolslab = NULL;
+static size_t poolslabbytes = 0;
+
+/** @brief Snapshotting malloc for small objects of one size, for use by
+ *  model-checker (not user progs) */
+void * snapshot_pool_malloc(size_t size)
+{
+	size_t sizeclass = (size + POOLGRANULE - 1) / POOLGRANULE;
+	if (sizeclass == 0 || sizeclass > POOLCLASSES)
+		return snapshot_malloc(size);
+
+	struct pool_block *block = poolfreelists[sizeclass - 1];
+	if (block != NULL) {
+		poolfreelists[sizeclass - 1] = block->next;
+		return block;
+	}
+
+	size_t bytes = sizeclass * POOLGRANULE;
+	if (poolslabbytes < bytes) {
+		/* The rest of the old slab is too small and is left unused */
+		poolslab = (char *)snapshot_malloc(POOLSLABBYTES);
+		poolslabbytes = POOLSLABBYTES;
+	}
+	void *tmp = poolslab;
+	poolslab += bytes;
+	poolslabbytes -= bytes;
+	return tmp;
+}
+
+/** @brief Frees a block from snapshot_pool_malloc, which must be given the
+ *  size it was allocated with */
+void snapshot_pool_free(void *ptr, size_t size)
+{
+	if (ptr == NULL)
+		return;
+	size_t sizeclass = (size + POOLGRANULE - 1) / POOLGRANULE;
+	if (sizeclass == 0 || sizeclass > POOLCLASSES) {
+		snapshot_free(ptr);
+		return;
+	}
+	struct pool_block *block = (struct pool_block *)ptr;
+	block->next = poolfreelists[sizeclass - 1];
+	poolfreelists[sizeclass - 1] = block;
+}
+
 /** Non-snapshotting free for our use. */
 void model_free(void *ptr)
 {
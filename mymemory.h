@@ -6,6 +6,7 @@
 #define _MY_MEMORY_H
 #include <limits>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "config.h"
 
@@ -47,6 +48,26 @@
 		return p; \
 	}
 
+/** SNAPSHOTPOOLALLOC is SNAPSHOTALLOC for small classes that are created
+ *	and deleted at a high rate: single objects come from free lists of
+ *	same-sized blocks in the snapshotting heap. */
+#define SNAPSHOTPOOLALLOC \
+	void * operator new(size_t size) { \
+		return snapshot_pool_malloc(size); \
+	} \
+	void operator delete(void *p, size_t size) { \
+		snapshot_pool_free(p, size); \
+	} \
+	void * operator new[](size_t size) { \
+		return snapshot_malloc(size); \
+	} \
+	void operator delete[](void *p, size_t size) { \
+		snapshot_free(p); \
+	} \
+	void * operator new(size_t size, void *p) {	/* placement new */ \
+		return p; \
+	}
+
 void *model_malloc(size_t size);
 void *model_calloc(size_t count, size_t size);
 void model_free(void *ptr);
@@ -56,6 +77,11 @@ void * snapshot_malloc(size_t size);
 void * snapshot_calloc(size_t count, size_t size);
 void * snapshot_realloc(void *ptr, size_t size);
 void snapshot_free(void *ptr);
+void * snapshot_pool_malloc(size_t size);
+void snapshot_pool_free(void *ptr, size_t size);
+
+/** @brief Calls that allocated from the snapshotting heap */
+extern uint64_t snapshot_heap_allocs;
 
 typedef void * mspace;
 extern mspace sStaticSpace;
@@ -257,6 +283,7 @@ extern void * mspace_realloc(mspace msp, void* mem, size_t newsize);
 extern void * mspace_calloc(mspace msp, size_t n_elements, size_t elem_size);
 extern mspace create_mspace_with_base(void* base, size_t capacity, int locked);
 extern mspace create_mspace(size_t capacity, int locked);
+extern int mspace_track_large_chunks(mspace msp, int enable);
 
 extern mspace model_snapshot_space;
 
@@ -12,6 +12,30 @@ struct model_params {
 	modelclock_t checkthreshold;
 	bool removevisible;
 
+	/** @brief Number of executions to run in parallel (1 = sequential) */
+	int numprocs;
+
+	/** @brief Fork the next execution's process ahead of time */
+	bool standby;
+
+	/** @brief Move the rollback snapshot to the first thread creation */
+	bool prefixsnapshot;
+
+	/** @brief Sample the race checks of words found race-free in this many
+	 *  executions (0 = check every access) */
+	unsigned int racesample;
+
+	/** @brief Lowest sampling rate, as one check per this many accesses */
+	unsigned int sampleperiod;
+
+	/** @brief Skip race checks of a thread's own stack (0 = off; 1 = until a
+	 *  pointer into it escapes; 2 = always) */
+	int stackfilter;
+
+	/** @brief Print the race detector's counters at the end of the run,
+	 *  also as a RACESTATS line of JSON */
+	bool racestats;
+
 	/** @brief Verbosity (0 = quiet; 1 = noisy; 2 = noisier) */
 	int verbose;
 };
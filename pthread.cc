@@ -17,6 +17,9 @@
 int pthread_create(pthread_t *t, const pthread_attr_t * attr,
 									 pthread_start_t start_routine, void * arg) {
 	createModelIfNotExist();
+	if (model->params.prefixsnapshot)
+		model->take_prefix_snapshot();
+	noteStackEscape(thread_current_id(), (uintptr_t)arg);
 	struct pthread_params params = { start_routine, arg };
 
 	/* seq_cst is just a 'don't care' parameter */
@@ -10,10 +10,24 @@
 typedef unsigned int snapshot_id;
 typedef void (*VoidFuncPtr)();
 
+struct execution_stats;
+struct DataRace;
+
 void snapshot_system_init(unsigned int numheappages);
 void startExecution();
 snapshot_id take_snapshot();
 void snapshot_roll_back(snapshot_id theSnapShot);
+void snapshot_finish_execution();
+void snapshot_merge_stats(const struct execution_stats *stats);
+void snapshot_merge_bug(const char *msg);
+bool snapshot_merge_race(struct DataRace *race);
+int snapshot_claim_execution();
+void snapshot_print_bugs();
+void snapshot_print_stats();
+bool snapshot_in_process();
+/* Called from the SIGSEGV handler while the GOT may be write-protected, so it
+ * must not go through a lazily bound PLT entry */
+bool snapshot_handle_fault(void *addr) __attribute__((visibility("hidden")));
 
 
 #endif
@@ -6,6 +6,13 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <time.h>
 
 #include "hashtable.h"
 #include "snapshot.h"
@@ -13,14 +20,76 @@
 #include "common.h"
 #include "context.h"
 #include "model.h"
+#include "threads-model.h"
+#include "datarace.h"
 
+/**
+ * @brief Sizes and page options of the snapshot regions
+ *
+ * The regions are mapped before the ModelChecker (which lives in them) parses
+ * its options, so these options are read from C11TESTER by the snapshot system
+ * itself.
+ */
+struct snapshot_config {
+	/** @brief Size of the shared memory heap */
+	size_t sharedmemsize;
+	/** @brief Size of the shared stack */
+	size_t stacksize;
+	/** @brief Size of the snapshot heap; 0 to use the size requested by
+	 *  snapshot_system_init() */
+	size_t heapsize;
+	/** @brief Huge pages for the snapshot heap: 0 = none, 1 = transparent,
+	 *  2 = explicit (hugetlbfs) */
+	int hugepages;
+};
+
+static struct snapshot_config config;
+static bool config_read = false;
 
-#define SHARED_MEMORY_DEFAULT  (200 * ((size_t)1 << 20))	// 100mb for the shared memory
-#define STACK_SIZE_DEFAULT      (((size_t)1 << 20) * 20)	// 20 mb out of the above 100 mb for my stack
+/** @brief Should executions be rolled back in-process? */
+static bool use_dirty_snapshots()
+{
+#ifdef DIRTY_PAGE_SNAPSHOT
+	return true;
+#else
+	/* Without fork, the in-process backend is the only way to roll back */
+	return model->params.nofork;
+#endif
+}
+
+/**
+ * @brief Log-scale histogram of durations (in nanoseconds)
+ *
+ * Each power of two is split into 8 buckets, so percentiles are accurate to
+ * within 12.5%.
+ */
+struct timing_histogram {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[64 * 8];
+};
+
+/** @brief Counters of the fork backend, reported with the final stats */
+struct fork_stats {
+	/** @brief Number of forks */
+	uint64_t forks;
+	/** @brief Total and largest size (in kB) of the page tables copied by
+	 *  a fork */
+	uint64_t pagetablekb;
+	uint64_t maxpagetablekb;
+
+	/** @brief Time the parent spends in fork() */
+	struct timing_histogram forktime;
+	/** @brief Time from the start of an execution to its rollback */
+	struct timing_histogram exectime;
+	/** @brief Time from the rollback of an execution until the next one can
+	 *  start: the child's exit and teardown, or the in-process restore */
+	struct timing_histogram rollbacktime;
+};
 
 struct fork_snapshotter {
 	/** @brief Pointer to the shared (non-snapshot) memory heap base
-	 * (NOTE: this has size SHARED_MEMORY_DEFAULT - sizeof(*fork_snap)) */
+	 * (NOTE: this has size config.sharedmemsize - sizeof(*fork_snap)) */
 	void *mSharedMemoryBase;
 
 	/** @brief Pointer to the shared (non-snapshot) stack region */
@@ -44,11 +113,78 @@ struct fork_snapshotter {
 
 	/** @brief Inter-process tracking of the next snapshot ID */
 	snapshot_id currSnapShotID;
+
+	/**
+	 * @brief The ticket of the standby child released to run, or
+	 * STANDBY_EXIT; standby children wait on this word with a futex
+	 */
+	volatile int mStandbyTicket;
+
+	/**
+	 * @brief The last ticket handed out to a standby child. Tickets are
+	 * unique over all snapshots, since the standby child of an earlier
+	 * snapshot is still waiting while a later snapshot runs its loop.
+	 */
+	int mLastStandbyTicket;
+
+	/** @brief Counters of the forks done for this process's executions */
+	struct fork_stats mStats;
+
+	/** @brief Monotonic times (in ns) at which the current execution
+	 *  started and at which it was rolled back */
+	uint64_t mExecStart;
+	uint64_t mRollbackStart;
 };
 
+#define STANDBY_EXIT -1
+
+/* Distinct bug reports a parallel run keeps, and the length kept of each */
+#define FARMBUGS 64
+#define FARMBUGLENGTH 512
+/* Distinct races a parallel run keeps; a power of two */
+#define FARMRACES 1024
+
 static struct fork_snapshotter *fork_snap = NULL;
 ucontext_t shared_ctxt;
 
+/**
+ * @brief Inter-process record for a parallel (-j) run
+ *
+ * Lives in its own small shared mapping, since each worker process gets a
+ * private copy of the regular shared memory region.
+ */
+struct fork_farm {
+	/** @brief Stats accumulated over all worker processes */
+	struct execution_stats stats;
+
+	/** @brief Fork counters accumulated over all worker processes */
+	struct fork_stats forkstats;
+
+	/** @brief Distinct bug reports of all worker processes */
+	struct {
+		/** @brief Number of executions that reported the bug */
+		unsigned int count;
+		char msg[FARMBUGLENGTH];
+	} bugs[FARMBUGS];
+	unsigned int numbugs;
+	/** @brief Reports of further distinct bugs, which did not fit */
+	unsigned int droppedbugs;
+	volatile int buglock;
+
+	/** @brief Distinct races reported by all worker processes, by
+	 *  race_hash with linear probing; the workers are forks of one
+	 *  process, so their stack frames are comparable */
+	struct DataRace races[FARMRACES];
+	bool raceused[FARMRACES];
+	unsigned int numraces;
+	volatile int racelock;
+
+	/** @brief The next execution number to hand out */
+	volatile int nextexecution;
+};
+
+static struct fork_farm *farm = NULL;
+
 /** @statics
  *   These variables are necessary because the stack is shared region and
  *   there exists a race between all processes executing the same function.
@@ -90,10 +226,122 @@ static void fork_exit()
 	_Exit(EXIT_SUCCESS);
 }
 
+/**
+ * @brief Match one C11TESTER token against a long option
+ * @param token The token, starting with "--"
+ * @param name The name of the option
+ * @param value Set to the value after '=', or NULL if there is none
+ * @return True if the token is the option
+ */
+static bool snapshot_match_option(const char *token, const char *name, const char **value)
+{
+	size_t len = strlen(name);
+	if (strncmp(token + 2, name, len) != 0)
+		return false;
+	char next = token[2 + len];
+	if (next != '\0' && next != ' ' && next != '=')
+		return false;
+	*value = next == '=' ? token + 3 + len : NULL;
+	return true;
+}
+
+/**
+ * @brief Copy an option value, which ends at the next space, to a buffer
+ * @return False if it does not fit
+ */
+static bool snapshot_copy_value(const char *value, char *buf, size_t bufsize)
+{
+	size_t len = strcspn(value, " ");
+	if (len >= bufsize)
+		return false;
+	memcpy(buf, value, len);
+	buf[len] = '\0';
+	return true;
+}
+
+/**
+ * @brief Parse the value of a size option, in MB
+ * @param arg The value
+ * @param size Set to the size in bytes
+ * @return False if the value is not a positive number
+ */
+bool snapshot_parse_size(const char *arg, size_t *size)
+{
+	unsigned int mb;
+	if (!parse_unsigned(arg, &mb) || mb == 0)
+		return false;
+	*size = (size_t)mb << 20;
+	return true;
+}
+
+/**
+ * @brief Parse the value of the --hugepages option
+ * @param arg The value, or NULL if none was given
+ * @param hugepages Set to the huge page mode
+ * @return False if the value is not one of the modes, 0 to 2
+ */
+bool snapshot_parse_hugepages(const char *arg, int *hugepages)
+{
+	unsigned int mode = 1;
+	if (arg != NULL && (!parse_unsigned(arg, &mode) || mode > 2))
+		return false;
+	*hugepages = mode;
+	return true;
+}
+
+/** @brief Read the snapshot options from the C11TESTER environment variable */
+static void snapshot_read_config()
+{
+	config_read = true;
+	config.sharedmemsize = SHARED_MEMORY_DEFAULT;
+	config.stacksize = STACK_SIZE_DEFAULT;
+	config.heapsize = 0;
+	config.hugepages = 0;
+
+	const char *options = getenv("C11TESTER");
+	if (options == NULL)
+		return;
+	for (const char *token = options;token != NULL;token = strchr(token, ' ')) {
+		while (*token == ' ')
+			token++;
+		if (strncmp(token, "--", 2) != 0)
+			continue;
+		const char *value;
+		const char *nexttoken = strchr(token, ' ');
+		/* Values the parsers reject keep the defaults here; parse_options()
+		 * then prints the usage message. */
+		char arg[32];
+		if (snapshot_match_option(token, "hugepages", &value)) {
+			if (value == NULL)
+				snapshot_parse_hugepages(NULL, &config.hugepages);
+			else if (snapshot_copy_value(value, arg, sizeof(arg)))
+				snapshot_parse_hugepages(arg, &config.hugepages);
+			continue;
+		}
+		size_t *size;
+		if (snapshot_match_option(token, "sharedmem", &value))
+			size = &config.sharedmemsize;
+		else if (snapshot_match_option(token, "sharedstack", &value))
+			size = &config.stacksize;
+		else if (snapshot_match_option(token, "snapshotmem", &value))
+			size = &config.heapsize;
+		else
+			continue;
+		/* Also accept the value as the next token, like getopt_long() */
+		if (value == NULL && nexttoken != NULL)
+			value = nexttoken + 1;
+		if (value != NULL && snapshot_copy_value(value, arg, sizeof(arg)))
+			snapshot_parse_size(arg, size);
+	}
+}
+
 static void createSharedMemory()
 {
+	if (!config_read)
+		snapshot_read_config();
+
 	//step 1. create shared memory.
-	void *memMapBase = mmap(0, SHARED_MEMORY_DEFAULT + STACK_SIZE_DEFAULT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	void *memMapBase = mmap(0, config.sharedmemsize + config.stacksize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
 	if (memMapBase == MAP_FAILED) {
 		perror("mmap");
 		exit(EXIT_FAILURE);
@@ -102,10 +350,14 @@ static void createSharedMemory()
 	//Setup snapshot record at top of free region
 	fork_snap = (struct fork_snapshotter *)memMapBase;
 	fork_snap->mSharedMemoryBase = (void *)((uintptr_t)memMapBase + sizeof(*fork_snap));
-	fork_snap->mStackBase = (void *)((uintptr_t)memMapBase + SHARED_MEMORY_DEFAULT);
-	fork_snap->mStackSize = STACK_SIZE_DEFAULT;
+	fork_snap->mStackBase = (void *)((uintptr_t)memMapBase + config.sharedmemsize);
+	fork_snap->mStackSize = config.stacksize;
 	fork_snap->mIDToRollback = -1;
 	fork_snap->currSnapShotID = 0;
+	fork_snap->mStandbyTicket = 0;
+	fork_snap->mLastStandbyTicket = 0;
+	fork_snap->mExecStart = 0;
+	fork_snap->mRollbackStart = 0;
 	sStaticSpace = create_shared_mspace();
 }
 
@@ -119,7 +371,42 @@ mspace create_shared_mspace()
 {
 	if (!fork_snap)
 		createSharedMemory();
-	return create_mspace_with_base((void *)(fork_snap->mSharedMemoryBase), SHARED_MEMORY_DEFAULT - sizeof(*fork_snap), 1);
+	return create_mspace_with_base((void *)(fork_snap->mSharedMemoryBase), config.sharedmemsize - sizeof(*fork_snap), 1);
+}
+
+/**
+ * @brief Map the snapshot heap on huge pages
+ *
+ * A fork then copies one page table entry for each 2MB page of the heap,
+ * rather than one for every 4KB page. Explicit huge pages fall back to
+ * transparent ones if the hugetlbfs pool is too small.
+ *
+ * @param size The size of the heap
+ * @return The base of the heap
+ */
+static void * snapshot_map_huge_heap(size_t size)
+{
+	size = (size + HUGEPAGESIZE - 1) & ~((size_t)HUGEPAGESIZE - 1);
+	if (config.hugepages > 1) {
+		void *base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+		if (base != MAP_FAILED)
+			return base;
+		model_print("Explicit huge pages unavailable; using transparent huge pages\n");
+	}
+
+	/* Over-allocate, so the heap can start on a huge page boundary */
+	char *map = (char *)mmap(0, size + HUGEPAGESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	char *base = (char *)(((uintptr_t)map + HUGEPAGESIZE - 1) & ~((uintptr_t)HUGEPAGESIZE - 1));
+	if (base != map)
+		munmap(map, base - map);
+	munmap(base + size, map + HUGEPAGESIZE - base);
+	if (madvise(base, size, MADV_HUGEPAGE) < 0)
+		perror("madvise(MADV_HUGEPAGE)");
+	return base;
 }
 
 static void fork_snapshot_init(unsigned int numheappages)
@@ -127,30 +414,458 @@ static void fork_snapshot_init(unsigned int numheappages)
 	if (!fork_snap)
 		createSharedMemory();
 
-	model_snapshot_space = create_mspace(numheappages * PAGESIZE, 1);
+	size_t heapsize = config.heapsize ? config.heapsize : numheappages * PAGESIZE;
+	if (config.hugepages) {
+		model_snapshot_space = create_mspace_with_base(snapshot_map_huge_heap(heapsize), heapsize, 1);
+		/* Keep large chunks (shadow tables, thread stacks) on the huge pages too */
+		mspace_track_large_chunks(model_snapshot_space, 1);
+	} else {
+		model_snapshot_space = create_mspace(heapsize, 1);
+	}
 }
 
 volatile int modellock = 0;
 
+/**
+ * @brief Detach this process from the shared memory region of its parent
+ *
+ * Replaces the shared region with a fresh shared mapping at the same address
+ * holding a copy of its current contents. Afterwards the region is only shared
+ * with the processes this one forks, so a parallel worker has its own
+ * ModelChecker state, stats and random number generator.
+ */
+static void fork_privatize_shared_memory()
+{
+	size_t size = config.sharedmemsize + config.stacksize;
+	size_t numpages = (size + PAGESIZE - 1) / PAGESIZE;
+	char *base = (char *)fork_snap;
+
+	char *copy = (char *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	if (copy == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Only copy pages that have been touched; the rest are still zero */
+	unsigned char *resident = (unsigned char *)snapshot_malloc(numpages);
+	if (mincore(base, size, resident) < 0) {
+		perror("mincore");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0;i < numpages;i++)
+		if (resident[i] & 1)
+			memcpy(copy + i * PAGESIZE, base + i * PAGESIZE, PAGESIZE);
+	snapshot_free(resident);
+
+	if (mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, base) == MAP_FAILED) {
+		perror("mremap");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Run the executions in several worker processes at once
+ *
+ * Each of up to numprocs workers returns from this function and runs
+ * executions through the regular fork loop. A worker starts with one
+ * execution and claims the next unclaimed one whenever it finishes one, so
+ * no worker idles while executions are left. The original process waits for
+ * all of them, then prints the combined stats and exits.
+ *
+ * @param numprocs The number of worker processes to fork
+ */
+static void fork_farm(int numprocs)
+{
+	farm = (struct fork_farm *)mmap(0, sizeof(*farm), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	if (farm == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	int maxexecutions = model->params.maxexecutions;
+	if (numprocs > maxexecutions)
+		numprocs = maxexecutions;
+	/* Worker i starts with execution i + 1 */
+	farm->nextexecution = numprocs + 1;
+
+	for (int i = 0;i < numprocs;i++) {
+		modellock = 1;
+		pid_t forkedID = fork();
+		modellock = 0;
+
+		if (forkedID < 0) {
+			perror("fork");
+			exit(EXIT_FAILURE);
+		} else if (0 == forkedID) {
+			fork_privatize_shared_memory();
+			model->start_parallel_worker(i, i + 1);
+			return;
+		}
+	}
+
+	bool failed = false;
+	while (numprocs > 0) {
+		int status;
+		pid_t pid = wait(&status);
+		if (pid >= 0) {
+			numprocs--;
+			if (WIFSIGNALED(status)) {
+				model_print("Worker process %d was killed by signal %d\n", pid, WTERMSIG(status));
+				failed = true;
+			} else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+				model_print("Worker process %d exited with status %d\n", pid, WEXITSTATUS(status));
+				failed = true;
+			}
+		} else if (errno != EINTR) {
+			/* wait() may be interrupted */
+			perror("wait");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	model->finish_parallel_run(&farm->stats, failed);
+}
+
+/** @brief Read the monotonic clock, in nanoseconds */
+static uint64_t snapshot_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int histogram_bucket(uint64_t ns)
+{
+	if (ns < 8)
+		return ns;
+	unsigned int msb = 63 - __builtin_clzll(ns);
+	return ((msb - 2) << 3) | ((ns >> (msb - 3)) & 7);
+}
+
+/** @return The largest duration that falls into a bucket */
+static uint64_t histogram_bucket_limit(unsigned int bucket)
+{
+	if (bucket < 8)
+		return bucket;
+	unsigned int msb = (bucket >> 3) + 2;
+	return (((uint64_t)(8 | (bucket & 7)) + 1) << (msb - 3)) - 1;
+}
+
+static void histogram_add(struct timing_histogram *h, uint64_t ns)
+{
+	h->count++;
+	h->buckets[histogram_bucket(ns)]++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/** @brief Add a histogram to another one, which other processes may update */
+static void histogram_merge(struct timing_histogram *into, const struct timing_histogram *from)
+{
+	__sync_fetch_and_add(&into->count, from->count);
+	for (unsigned int i = 0;i < sizeof(from->buckets) / sizeof(from->buckets[0]);i++)
+		if (from->buckets[i])
+			__sync_fetch_and_add(&into->buckets[i], from->buckets[i]);
+	uint64_t max;
+	while ((max = into->max) < from->max)
+		__sync_bool_compare_and_swap(&into->max, max, from->max);
+}
+
+/** @return The upper bound of the bucket holding the given percentile */
+static uint64_t histogram_percentile(const struct timing_histogram *h, unsigned int percent)
+{
+	uint64_t target = (h->count * percent + 99) / 100;
+	uint64_t seen = 0;
+	for (unsigned int i = 0;i < sizeof(h->buckets) / sizeof(h->buckets[0]);i++) {
+		seen += h->buckets[i];
+		if (seen >= target) {
+			uint64_t limit = histogram_bucket_limit(i);
+			return limit < h->max ? limit : h->max;
+		}
+	}
+	return h->max;
+}
+
+static void histogram_print(const char *name, const struct timing_histogram *h)
+{
+	if (h->count == 0)
+		return;
+	model_print("%-22s p50 %8" PRIu64 " us, p99 %8" PRIu64 " us, max %8" PRIu64 " us (%" PRIu64 " samples)\n",
+							name, histogram_percentile(h, 50) / 1000, histogram_percentile(h, 99) / 1000,
+							h->max / 1000, h->count);
+}
+
+/**
+ * @brief Record the time of the final execution of this process, which ends
+ * without being rolled back
+ */
+void snapshot_finish_execution()
+{
+	histogram_add(&fork_snap->mStats.exectime, snapshot_now() - fork_snap->mExecStart);
+}
+
+/**
+ * @brief Add the stats of a finished parallel worker to the run's totals
+ * @param stats The worker's stats
+ */
+void snapshot_merge_stats(const struct execution_stats *stats)
+{
+	ASSERT(farm);
+	__sync_fetch_and_add(&farm->stats.num_total, stats->num_total);
+	__sync_fetch_and_add(&farm->stats.num_buggy_executions, stats->num_buggy_executions);
+	__sync_fetch_and_add(&farm->stats.num_complete, stats->num_complete);
+	__sync_fetch_and_add(&farm->stats.num_memory_actions, stats->num_memory_actions);
+	__sync_fetch_and_add(&farm->stats.num_memory_action_allocs, stats->num_memory_action_allocs);
+	mergeRaceStats(&farm->stats.race, &stats->race);
+
+	struct fork_stats *forkstats = &fork_snap->mStats;
+	__sync_fetch_and_add(&farm->forkstats.forks, forkstats->forks);
+	__sync_fetch_and_add(&farm->forkstats.pagetablekb, forkstats->pagetablekb);
+	uint64_t max;
+	while ((max = farm->forkstats.maxpagetablekb) < forkstats->maxpagetablekb)
+		__sync_bool_compare_and_swap(&farm->forkstats.maxpagetablekb, max, forkstats->maxpagetablekb);
+	histogram_merge(&farm->forkstats.forktime, &forkstats->forktime);
+	histogram_merge(&farm->forkstats.exectime, &forkstats->exectime);
+	histogram_merge(&farm->forkstats.rollbacktime, &forkstats->rollbacktime);
+}
+
+/**
+ * @brief Add a bug reported by an execution of a parallel worker to the bug
+ * list of the run
+ * @param msg The bug report, as printed
+ */
+void snapshot_merge_bug(const char *msg)
+{
+	ASSERT(farm);
+	while (__sync_lock_test_and_set(&farm->buglock, 1))
+		;
+	unsigned int i;
+	for (i = 0;i < farm->numbugs;i++)
+		if (strncmp(farm->bugs[i].msg, msg, FARMBUGLENGTH - 1) == 0)
+			break;
+	if (i < farm->numbugs) {
+		farm->bugs[i].count++;
+	} else if (i < FARMBUGS) {
+		strncpy(farm->bugs[i].msg, msg, FARMBUGLENGTH - 1);
+		farm->bugs[i].count = 1;
+		farm->numbugs++;
+	} else {
+		farm->droppedbugs++;
+	}
+	__sync_lock_release(&farm->buglock);
+}
+
+/**
+ * @brief Claim the next execution of a parallel run for this worker
+ * @return The number of the execution; it is past the last one when none
+ * are left
+ */
+int snapshot_claim_execution()
+{
+	ASSERT(farm);
+	return __sync_fetch_and_add(&farm->nextexecution, 1);
+}
+
+/**
+ * @brief Add a race to the races reported by all workers of a parallel run
+ * @param race The race, with its backtrace captured
+ * @return Whether the race should be reported: it is not a parallel run, or
+ * no worker has reported the race before
+ */
+bool snapshot_merge_race(struct DataRace *race)
+{
+	if (!farm)
+		return true;
+	bool isnew = true;
+	unsigned int hash = race_hash(race);
+	while (__sync_lock_test_and_set(&farm->racelock, 1))
+		;
+	for (unsigned int i = 0;i < FARMRACES;i++) {
+		unsigned int slot = (hash + i) & (FARMRACES - 1);
+		if (!farm->raceused[slot]) {
+			/* Once the table is full, races are reported by each worker */
+			if (farm->numraces < FARMRACES - 1) {
+				farm->races[slot] = *race;
+				farm->raceused[slot] = true;
+				farm->numraces++;
+			}
+			break;
+		}
+		if (race_equals(&farm->races[slot], race)) {
+			isnew = false;
+			break;
+		}
+	}
+	__sync_lock_release(&farm->racelock);
+	return isnew;
+}
+
+/** @brief Print the distinct bugs that the workers of a parallel run found */
+void snapshot_print_bugs()
+{
+	if (!farm || farm->numbugs == 0)
+		return;
+	model_print("Bug report over all workers: %u distinct bug%s\n",
+							farm->numbugs, farm->numbugs > 1 ? "s" : "");
+	for (unsigned int i = 0;i < farm->numbugs;i++)
+		model_print("%s    (in %u execution%s)\n", farm->bugs[i].msg,
+								farm->bugs[i].count, farm->bugs[i].count > 1 ? "s" : "");
+	if (farm->droppedbugs != 0)
+		model_print("  ... and %u more bug reports\n", farm->droppedbugs);
+}
+
+/**
+ * @brief Are executions rolled back in-process?
+ *
+ * The in-process backend scans every writable private mapping, so callers
+ * should not create large sparse mappings in that mode.
+ */
+bool snapshot_in_process()
+{
+	return use_dirty_snapshots();
+}
+
+/** @brief Print the counters of the snapshot system, after the final stats */
+void snapshot_print_stats()
+{
+	const struct fork_stats *stats = farm ? &farm->forkstats : &fork_snap->mStats;
+	if (stats->forks != 0)
+		model_print("Page tables copied per fork: %" PRIu64 " kB on average, %" PRIu64 " kB max (over %" PRIu64 " forks)\n",
+								stats->pagetablekb / stats->forks, stats->maxpagetablekb, stats->forks);
+	histogram_print("Fork time:", &stats->forktime);
+	histogram_print("Execution time:", &stats->exectime);
+	histogram_print(use_dirty_snapshots() ? "Restore time:" : "Exit/teardown time:", &stats->rollbacktime);
+}
+
+/** @brief Read the size (in kB) of this process's page tables */
+static uint64_t fork_page_table_kb()
+{
+	char buf[4096];
+	int fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+	char *pte = strstr(buf, "VmPTE:");
+	return pte ? strtoull(pte + 6, NULL, 10) : 0;
+}
+
+/**
+ * @brief Record the page tables a fork copied, in the new child
+ *
+ * Must be called right after the fork, before the child touches any memory.
+ */
+static void fork_record_page_tables()
+{
+	uint64_t kb = fork_page_table_kb();
+	struct fork_stats *stats = &fork_snap->mStats;
+	stats->forks++;
+	stats->pagetablekb += kb;
+	if (kb > stats->maxpagetablekb)
+		stats->maxpagetablekb = kb;
+}
+
+/**
+ * @brief Fork a standby child, which waits until it is released to run
+ * @param ticket The ticket the child waits for in mStandbyTicket
+ * @return The PID of the child
+ */
+static pid_t fork_standby(int ticket)
+{
+	uint64_t start = snapshot_now();
+	modellock = 1;
+	pid_t forkedID = fork();
+	modellock = 0;
+
+	if (forkedID < 0) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	} else if (0 == forkedID) {
+		fork_record_page_tables();
+		int curr;
+		while ((curr = fork_snap->mStandbyTicket) != STANDBY_EXIT && curr != ticket)
+			syscall(SYS_futex, &fork_snap->mStandbyTicket, FUTEX_WAIT, curr, NULL, NULL, 0);
+		if (curr == STANDBY_EXIT)
+			_Exit(EXIT_SUCCESS);
+		setcontext(&shared_ctxt);
+	}
+	histogram_add(&fork_snap->mStats.forktime, snapshot_now() - start);
+	return forkedID;
+}
+
+/** @brief Release the standby child holding a ticket (or STANDBY_EXIT) */
+static void fork_release_standby(int ticket)
+{
+	fork_snap->mStandbyTicket = ticket;
+	syscall(SYS_futex, &fork_snap->mStandbyTicket, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * @brief The fork loop, with the next child forked ahead of time
+ *
+ * While one child runs an execution, the child for the next execution is
+ * already forked and parked on a futex, so the fork is off the critical path.
+ */
+static void fork_standby_loop()
+{
+	fork_snap->currSnapShotID = snapshotid + 1;
+	int ticket = ++fork_snap->mLastStandbyTicket;
+	pid_t next = fork_standby(ticket);
+
+	while (true) {
+		pid_t running = next;
+		fork_release_standby(ticket);
+		ticket = ++fork_snap->mLastStandbyTicket;
+		next = fork_standby(ticket);
+
+		DEBUG("parent PID: %d, child PID: %d, snapshot ID: %d\n",
+					getpid(), running, snapshotid);
+
+		while (waitpid(running, NULL, 0) < 0) {
+			/* waitpid() may be interrupted */
+			if (errno != EINTR) {
+				perror("waitpid");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if (fork_snap->mIDToRollback != snapshotid) {
+			fork_release_standby(STANDBY_EXIT);
+			while (waitpid(next, NULL, 0) < 0 && errno == EINTR)
+				;
+			_Exit(EXIT_SUCCESS);
+		}
+		histogram_add(&fork_snap->mStats.rollbacktime, snapshot_now() - fork_snap->mRollbackStart);
+	}
+}
+
 static void fork_loop() {
 	/* switch back here when takesnapshot is called */
 	snapshotid = fork_snap->currSnapShotID;
-	if (model->params.nofork) {
-		setcontext(&shared_ctxt);
-		_Exit(EXIT_SUCCESS);
-	}
+
+	if (model->params.numprocs > 1 && !farm)
+		fork_farm(model->params.numprocs);
+
+	if (model->params.standby)
+		fork_standby_loop();
 
 	while (true) {
 		pid_t forkedID;
 		fork_snap->currSnapShotID = snapshotid + 1;
 
+		uint64_t start = snapshot_now();
 		modellock = 1;
 		forkedID = fork();
 		modellock = 0;
 
 		if (0 == forkedID) {
+			fork_record_page_tables();
 			setcontext(&shared_ctxt);
 		} else {
+			histogram_add(&fork_snap->mStats.forktime, snapshot_now() - start);
 			DEBUG("parent PID: %d, child PID: %d, snapshot ID: %d\n",
 						getpid(), forkedID, snapshotid);
 
@@ -164,29 +879,823 @@ static void fork_loop() {
 
 			if (fork_snap->mIDToRollback != snapshotid)
 				_Exit(EXIT_SUCCESS);
+			histogram_add(&fork_snap->mStats.rollbacktime, snapshot_now() - fork_snap->mRollbackStart);
 		}
 	}
 }
 
 static void fork_startExecution() {
 	/* switch to a new entryPoint context, on a new stack */
-	create_context(&private_ctxt, snapshot_calloc(STACK_SIZE_DEFAULT, 1), STACK_SIZE_DEFAULT, fork_loop);
+	create_context(&private_ctxt, snapshot_calloc(config.stacksize, 1), config.stacksize, fork_loop);
 }
 
 static snapshot_id fork_take_snapshot() {
 	model_swapcontext(&shared_ctxt, &private_ctxt);
 	DEBUG("TAKESNAPSHOT RETURN\n");
 	fork_snap->mIDToRollback = -1;
+	fork_snap->mExecStart = snapshot_now();
 	return snapshotid;
 }
 
 static void fork_roll_back(snapshot_id theID)
 {
 	DEBUG("Rollback\n");
+	fork_snap->mRollbackStart = snapshot_now();
+	histogram_add(&fork_snap->mStats.exectime, fork_snap->mRollbackStart - fork_snap->mExecStart);
 	fork_snap->mIDToRollback = theID;
 	fork_exit();
 }
 
+/** @brief A mapping of the process, as listed in /proc/self/maps */
+struct dirty_mapping {
+	uintptr_t start;
+	uintptr_t end;
+	int prot;
+	/** @brief Is this an explicit huge page mapping? Soft-dirty bits and
+	 *  dropping single pages do not work there. */
+	bool hugetlb;
+	/** @brief Is this the main thread's stack? It grows down past its
+	 *  listed start, so it cannot be write-protected. */
+	bool stack;
+	/** @brief Is the mapping write-protected to catch writes to it? Only
+	 *  without soft-dirty bits; see snapshot_handle_fault() */
+	bool tracked;
+	/** @brief Must all pages of a tracked mapping be restored, as its writes
+	 *  were not all caught? */
+	bool allwritten;
+	/** @brief Offset (in pages) of the saved contents in the backing store;
+	 *  only meaningful for writable mappings */
+	size_t backingpage;
+};
+
+/** @brief A growable list of mappings, kept in non-snapshot memory */
+struct dirty_mapping_list {
+	struct dirty_mapping *array;
+	unsigned int size;
+	unsigned int capacity;
+};
+
+/* Bits of a /proc/self/pagemap entry */
+#define PM_SOFT_DIRTY (1ULL << 55)
+#define PM_SWAPPED (1ULL << 62)
+#define PM_PRESENT (1ULL << 63)
+
+/** @brief Number of pagemap entries read at once */
+#define PAGEMAP_BATCH 512
+
+/* Where glibc registered this thread's rseq area; weak, for older glibc */
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+
+struct dirty_snapshotter {
+	/** @brief Private mappings at the time of the snapshot */
+	struct dirty_mapping_list mappings;
+
+	/** @brief Scratch list for the mappings at the time of a rollback */
+	struct dirty_mapping_list current;
+
+	/** @brief Saved contents of the writable private mappings; one page
+	 *  slot for every page, only the pages present at snapshot are filled */
+	char *backing;
+	size_t backingpages;
+
+	/** @brief One bit per backing store page: was the page saved? */
+	uint64_t *saved;
+
+	/** @brief Program break at the time of the snapshot */
+	uintptr_t brk;
+
+	/** @brief File descriptors open at the time of the snapshot */
+	int *fds;
+	unsigned int numfds;
+	unsigned int fdcapacity;
+
+	/** @brief Copies of stdin, stdout and stderr at the time of the snapshot */
+	int stdfds[3];
+
+	/** @brief Buffer for reading /proc/self/maps */
+	char *mapsbuf;
+	size_t mapsbufsize;
+
+	int pagemapfd;
+	int clearrefsfd;
+
+	/** @brief Does the kernel track soft-dirty bits? If not, the writable
+	 *  mappings are write-protected, and the first write to each page is
+	 *  caught by snapshot_handle_fault(). */
+	bool softdirty;
+
+	/** @brief Page of the main thread's rseq area, or 0. The kernel writes
+	 *  it when the thread is scheduled and kills the process if it cannot,
+	 *  so it is never write-protected. */
+	uintptr_t rseqpage;
+
+	/** @brief Are the tracked mappings write-protected? */
+	volatile bool protecting;
+	/** @brief One bit per backing store page: was the page written since
+	 *  the snapshot? Only for tracked mappings */
+	uint64_t *written;
+	/** @brief The pages written since the snapshot, in the order of their
+	 *  first write */
+	uintptr_t *writtenpages;
+	volatile size_t numwritten;
+};
+
+static struct dirty_snapshotter *dirty_snap = NULL;
+static ucontext_t dirty_ctxt;
+
+/** @brief Clear the soft-dirty bits of all pages of the process */
+static void dirty_clear_refs()
+{
+	if (dirty_snap->clearrefsfd < 0)
+		return;
+	if (pwrite(dirty_snap->clearrefsfd, "4", 1, 0) != 1) {
+		perror("clear_refs");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Read the pagemap entries of a range of pages
+ *
+ * Where /proc/self/pagemap is not available (e.g., in some sandboxes), the
+ * present bits come from mincore() instead.
+ *
+ * @param addr The page-aligned address of the first page
+ * @param num The number of pages, at most PAGEMAP_BATCH
+ * @param entries Array to store the entries in
+ */
+static void dirty_read_pagemap(uintptr_t addr, size_t num, uint64_t *entries)
+{
+	if (dirty_snap->pagemapfd < 0) {
+		unsigned char resident[PAGEMAP_BATCH];
+		if (mincore((void *)addr, num * PAGESIZE, resident) < 0) {
+			perror("mincore");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0;i < num;i++)
+			entries[i] = (resident[i] & 1) ? PM_PRESENT : 0;
+		return;
+	}
+	size_t len = num * sizeof(uint64_t);
+	if (pread(dirty_snap->pagemapfd, entries, len, (addr / PAGESIZE) * sizeof(uint64_t)) != (ssize_t)len) {
+		perror("pagemap");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Check whether the kernel sets soft-dirty bits on writes
+ *
+ * Soft-dirty tracking may be compiled out of the kernel, or the bits may
+ * never get set (e.g., under some virtualization), so test it on a probe page.
+ */
+static bool dirty_probe_softdirty()
+{
+	if (dirty_snap->pagemapfd < 0 || dirty_snap->clearrefsfd < 0)
+		return false;
+	volatile char *probe = (volatile char *)mmap(0, PAGESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (probe == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	uint64_t before, after;
+	probe[0] = 1;
+	dirty_clear_refs();
+	dirty_read_pagemap((uintptr_t)probe, 1, &before);
+	probe[0] = 2;
+	dirty_read_pagemap((uintptr_t)probe, 1, &after);
+	munmap((void *)probe, PAGESIZE);
+	return !(before & PM_SOFT_DIRTY) && (after & PM_SOFT_DIRTY);
+}
+
+static void dirty_snapshot_init()
+{
+	dirty_snap = (struct dirty_snapshotter *)model_calloc(1, sizeof(*dirty_snap));
+	dirty_snap->pagemapfd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	dirty_snap->clearrefsfd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+	dirty_snap->softdirty = dirty_probe_softdirty();
+	if (&__rseq_size != NULL && __rseq_size != 0)
+		dirty_snap->rseqpage = ((uintptr_t)__builtin_thread_pointer() + __rseq_offset) & ~((uintptr_t)PAGESIZE - 1);
+	/* Bind mprotect before the first capture saves our GOT: the fault
+	 * handler calls it, and the lazy binder writes ld.so's own data, which
+	 * may be write-protected by then */
+	mprotect(NULL, 0, PROT_NONE);
+	for (int i = 0;i < 3;i++)
+		dirty_snap->stdfds[i] = -1;
+	DEBUG("soft-dirty tracking: %d\n", dirty_snap->softdirty);
+}
+
+/**
+ * @brief Is a mapping, as listed in /proc/self/maps, backed by hugetlbfs?
+ * @param path The path field of the mapping; empty for anonymous memory
+ *
+ * Private MAP_HUGETLB memory is listed as /anon_hugepage.  Other huge page
+ * mappings are of files on a hugetlbfs mount, which must be aligned to
+ * huge pages; only those are checked with statfs().
+ */
+static bool dirty_mapping_hugetlb(const char *path, uintptr_t start, uintptr_t end)
+{
+	if (strncmp(path, "/anon_hugepage", 14) == 0 && (path[14] == '\0' || path[14] == ' '))
+		return true;
+	if (path[0] != '/' || ((start | end) & (HUGEPAGESIZE - 1)) != 0)
+		return false;
+	char file[PATH_MAX];
+	size_t len = strlen(path);
+	/* An unlinked file is listed with " (deleted)" appended */
+	if (len > 10 && strcmp(path + len - 10, " (deleted)") == 0)
+		len -= 10;
+	if (len >= sizeof(file))
+		return false;
+	memcpy(file, path, len);
+	file[len] = '\0';
+	struct statfs fs;
+	return statfs(file, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC;
+}
+
+/** @brief Append a mapping to a mapping list */
+static void dirty_push_mapping(struct dirty_mapping_list *list, uintptr_t start, uintptr_t end, int prot, bool hugetlb, bool stack)
+{
+	if (list->size == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		list->array = (struct dirty_mapping *)model_realloc(list->array, list->capacity * sizeof(struct dirty_mapping));
+	}
+	struct dirty_mapping *m = &list->array[list->size++];
+	m->start = start;
+	m->end = end;
+	m->prot = prot;
+	m->hugetlb = hugetlb;
+	m->stack = stack;
+	m->tracked = false;
+	m->allwritten = false;
+	m->backingpage = 0;
+}
+
+/** @brief Find the mapping of a list that holds an address, or NULL */
+static struct dirty_mapping * dirty_find_mapping(struct dirty_mapping_list *list, uintptr_t addr)
+{
+	/* /proc/self/maps lists the mappings in address order */
+	unsigned int low = 0, high = list->size;
+	while (low < high) {
+		unsigned int mid = (low + high) / 2;
+		struct dirty_mapping *m = &list->array[mid];
+		if (addr < m->start)
+			high = mid;
+		else if (addr >= m->end)
+			low = mid + 1;
+		else
+			return m;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Read the private mappings of the process from /proc/self/maps
+ *
+ * Shared mappings hold the model checker's own state (and this snapshotter's
+ * saved pages), so they are left out. Nothing here may allocate from the
+ * snapshotted heaps.
+ *
+ * @param list The list to fill
+ */
+static void dirty_read_mappings(struct dirty_mapping_list *list)
+{
+	int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("open maps");
+		exit(EXIT_FAILURE);
+	}
+	size_t len = 0;
+	while (true) {
+		if (len + PAGESIZE > dirty_snap->mapsbufsize) {
+			dirty_snap->mapsbufsize = dirty_snap->mapsbufsize ? dirty_snap->mapsbufsize * 2 : 16 * PAGESIZE;
+			dirty_snap->mapsbuf = (char *)model_realloc(dirty_snap->mapsbuf, dirty_snap->mapsbufsize);
+		}
+		ssize_t ret = read(fd, dirty_snap->mapsbuf + len, dirty_snap->mapsbufsize - len - 1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read maps");
+			exit(EXIT_FAILURE);
+		}
+		if (ret == 0)
+			break;
+		len += ret;
+	}
+	close(fd);
+	dirty_snap->mapsbuf[len] = '\0';
+
+	list->size = 0;
+	char *line = dirty_snap->mapsbuf;
+	while (*line) {
+		char *next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+
+		/* Format: start-end perms offset dev inode path */
+		char *p;
+		uintptr_t start = strtoul(line, &p, 16);
+		uintptr_t end = strtoul(p + 1, &p, 16);
+		p++;
+		int prot = (p[0] == 'r' ? PROT_READ : 0) | (p[1] == 'w' ? PROT_WRITE : 0) | (p[2] == 'x' ? PROT_EXEC : 0);
+		/* Skip the perms, offset, dev and inode fields to the path */
+		char *path = p;
+		for (int field = 0;field < 4 && *path;field++) {
+			path += strcspn(path, " ");
+			path += strspn(path, " ");
+		}
+		if (p[3] == 'p' && strcmp(path, "[vsyscall]") != 0)
+			dirty_push_mapping(list, start, end, prot, dirty_mapping_hugetlb(path, start, end), strcmp(path, "[stack]") == 0);
+		line = next;
+	}
+}
+
+/**
+ * @brief Call a function on each file descriptor that is open
+ * @param func The function to call; it may close the descriptor
+ */
+static void dirty_for_each_fd(void (*func)(int fd))
+{
+	char buf[4096];
+	int dirfd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		perror("open fd");
+		exit(EXIT_FAILURE);
+	}
+	while (true) {
+		long len = syscall(SYS_getdents64, dirfd, buf, sizeof(buf));
+		if (len < 0) {
+			perror("getdents64");
+			exit(EXIT_FAILURE);
+		}
+		if (len == 0)
+			break;
+		for (long pos = 0;pos < len;) {
+			/* struct linux_dirent64: ino, off, reclen, type, name */
+			unsigned short reclen = *(unsigned short *)(buf + pos + 16);
+			const char *name = buf + pos + 19;
+			if (name[0] >= '0' && name[0] <= '9') {
+				int fd = atoi(name);
+				if (fd != dirfd)
+					func(fd);
+			}
+			pos += reclen;
+		}
+	}
+	close(dirfd);
+}
+
+static void dirty_save_fd(int fd)
+{
+	if (dirty_snap->numfds == dirty_snap->fdcapacity) {
+		dirty_snap->fdcapacity = dirty_snap->fdcapacity ? dirty_snap->fdcapacity * 2 : 64;
+		dirty_snap->fds = (int *)model_realloc(dirty_snap->fds, dirty_snap->fdcapacity * sizeof(int));
+	}
+	dirty_snap->fds[dirty_snap->numfds++] = fd;
+}
+
+/** @brief Close a file descriptor unless it was open at the snapshot */
+static void dirty_restore_fd(int fd)
+{
+	for (unsigned int i = 0;i < dirty_snap->numfds;i++)
+		if (dirty_snap->fds[i] == fd)
+			return;
+	close(fd);
+}
+
+/**
+ * @brief Write-protect a range of a tracked mapping, except the rseq page
+ * @return The result of mprotect()
+ */
+static int dirty_write_protect(struct dirty_mapping *m, uintptr_t start, uintptr_t end)
+{
+	int prot = m->prot & ~PROT_WRITE;
+	uintptr_t rseq = dirty_snap->rseqpage;
+	if (rseq >= start && rseq < end) {
+		if (rseq > start && mprotect((void *)start, rseq - start, prot) < 0)
+			return -1;
+		start = rseq + PAGESIZE;
+		if (start == end)
+			return 0;
+	}
+	return mprotect((void *)start, end - start, prot);
+}
+
+/**
+ * @brief Record a page of a tracked mapping as written
+ * @return Whether it was recorded already
+ */
+static bool dirty_mark_written(struct dirty_mapping *m, uintptr_t page)
+{
+	size_t index = m->backingpage + (page - m->start) / PAGESIZE;
+	uint64_t bit = 1ULL << (index % 64);
+	if (__sync_fetch_and_or(&dirty_snap->written[index / 64], bit) & bit)
+		return true;
+	dirty_snap->writtenpages[__sync_fetch_and_add(&dirty_snap->numwritten, 1)] = page;
+	return false;
+}
+
+/** @brief Record the rseq page, which is never write-protected, as written */
+static void dirty_mark_rseq_written()
+{
+	struct dirty_mapping *m = dirty_find_mapping(&dirty_snap->mappings, dirty_snap->rseqpage);
+	if (m && m->tracked)
+		dirty_mark_written(m, dirty_snap->rseqpage);
+}
+
+/**
+ * @brief Write-protect the tracked mappings, or make them writable again
+ * @param protect Whether to write-protect them
+ */
+static void dirty_protect_all(bool protect)
+{
+	struct dirty_mapping_list *list = &dirty_snap->mappings;
+	for (unsigned int i = 0;i < list->size;i++) {
+		struct dirty_mapping *m = &list->array[i];
+		if (!m->tracked)
+			continue;
+		if (protect) {
+			if (dirty_write_protect(m, m->start, m->end) < 0) {
+				perror("mprotect");
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			/* The program may have unmapped parts since the snapshot */
+			mprotect((void *)m->start, m->end - m->start, m->prot);
+		}
+		m->allwritten = false;
+	}
+	dirty_snap->protecting = protect;
+	if (protect)
+		dirty_mark_rseq_written();
+}
+
+/**
+ * @brief Catch the first write to a page since the snapshot
+ *
+ * Without soft-dirty bits, the writable mappings are write-protected at the
+ * snapshot. The SIGSEGV handler calls this for each fault; the first write
+ * to a page records it as written and makes it writable again. Faults can
+ * come from several threads at once (the TLS helper threads).
+ *
+ * @param addr The faulting address
+ * @return True if the fault was such a write, which can now be retried
+ */
+bool snapshot_handle_fault(void *addr)
+{
+	if (!dirty_snap || !dirty_snap->protecting)
+		return false;
+	uintptr_t page = (uintptr_t)addr & ~((uintptr_t)PAGESIZE - 1);
+	struct dirty_mapping *m = dirty_find_mapping(&dirty_snap->mappings, page);
+	if (!m || !m->tracked)
+		return false;
+	dirty_mark_written(m, page);
+	if (mprotect((void *)page, PAGESIZE, m->prot) == 0)
+		return true;
+	/* Out of mappings (vm.max_map_count): restore this one in full instead */
+	m->allwritten = true;
+	return mprotect((void *)m->start, m->end - m->start, m->prot) == 0;
+}
+
+/** @brief Free the saved contents of the previous snapshot */
+static void dirty_release()
+{
+	if (dirty_snap->backing) {
+		munmap(dirty_snap->backing, dirty_snap->backingpages * PAGESIZE);
+		munmap(dirty_snap->saved, ((dirty_snap->backingpages + 63) / 64) * sizeof(uint64_t));
+		dirty_snap->backing = NULL;
+	}
+	if (dirty_snap->written) {
+		munmap(dirty_snap->written, ((dirty_snap->backingpages + 63) / 64) * sizeof(uint64_t));
+		munmap(dirty_snap->writtenpages, dirty_snap->backingpages * sizeof(uintptr_t));
+		dirty_snap->written = NULL;
+	}
+	for (int i = 0;i < 3;i++) {
+		if (dirty_snap->stdfds[i] >= 0)
+			close(dirty_snap->stdfds[i]);
+		dirty_snap->stdfds[i] = -1;
+	}
+	dirty_snap->numfds = 0;
+}
+
+/**
+ * @brief Save the state of the process
+ *
+ * Runs on the shared stack, so the regular stack is saved at a quiescent
+ * point (inside dirty_take_snapshot).
+ */
+static void dirty_capture()
+{
+	if (dirty_snap->protecting) {
+		dirty_protect_all(false);
+		dirty_snap->numwritten = 0;
+	}
+	dirty_release();
+
+	for (int i = 0;i < 3;i++)
+		dirty_snap->stdfds[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+	dirty_for_each_fd(dirty_save_fd);
+	dirty_snap->brk = syscall(SYS_brk, 0);
+
+	struct dirty_mapping_list *list = &dirty_snap->mappings;
+	dirty_read_mappings(list);
+
+	size_t numpages = 0;
+	for (unsigned int i = 0;i < list->size;i++) {
+		struct dirty_mapping *m = &list->array[i];
+		m->backingpage = numpages;
+		if (m->prot & PROT_WRITE)
+			numpages += (m->end - m->start) / PAGESIZE;
+	}
+
+	/* Only the pages we copy into will be backed by memory */
+	dirty_snap->backingpages = numpages;
+	dirty_snap->backing = (char *)mmap(0, numpages * PAGESIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON | MAP_NORESERVE, -1, 0);
+	dirty_snap->saved = (uint64_t *)mmap(0, ((numpages + 63) / 64) * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	if (dirty_snap->backing == MAP_FAILED || dirty_snap->saved == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t entries[PAGEMAP_BATCH];
+	for (unsigned int i = 0;i < list->size;i++) {
+		struct dirty_mapping *m = &list->array[i];
+		if (!(m->prot & PROT_WRITE))
+			continue;
+		size_t mpages = (m->end - m->start) / PAGESIZE;
+		for (size_t off = 0;off < mpages;off += PAGEMAP_BATCH) {
+			size_t num = mpages - off < PAGEMAP_BATCH ? mpages - off : PAGEMAP_BATCH;
+			dirty_read_pagemap(m->start + off * PAGESIZE, num, entries);
+			for (size_t j = 0;j < num;j++) {
+				if (!(entries[j] & (PM_PRESENT | PM_SWAPPED)))
+					continue;
+				size_t page = m->backingpage + off + j;
+				memcpy(dirty_snap->backing + page * PAGESIZE, (char *)(m->start + (off + j) * PAGESIZE), PAGESIZE);
+				dirty_snap->saved[page / 64] |= 1ULL << (page % 64);
+			}
+		}
+	}
+
+	if (dirty_snap->softdirty) {
+		dirty_clear_refs();
+		return;
+	}
+
+	dirty_snap->written = (uint64_t *)mmap(0, ((numpages + 63) / 64) * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+	dirty_snap->writtenpages = (uintptr_t *)mmap(0, numpages * sizeof(uintptr_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON | MAP_NORESERVE, -1, 0);
+	if (dirty_snap->written == MAP_FAILED || dirty_snap->writtenpages == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	for (unsigned int i = 0;i < list->size;i++) {
+		struct dirty_mapping *m = &list->array[i];
+		m->tracked = (m->prot & PROT_WRITE) && !m->hugetlb && !m->stack;
+	}
+	dirty_protect_all(true);
+}
+
+/** @brief Does any mapping in a list overlap the given range? */
+static bool dirty_overlaps(struct dirty_mapping_list *list, uintptr_t start, uintptr_t end)
+{
+	for (unsigned int i = 0;i < list->size;i++)
+		if (list->array[i].start < end && start < list->array[i].end)
+			return true;
+	return false;
+}
+
+/** @brief Were all pages of a range of a tracked mapping caught as written? */
+static bool dirty_all_written(struct dirty_mapping *m, uintptr_t start, uintptr_t end)
+{
+	for (uintptr_t addr = start;addr < end;addr += PAGESIZE) {
+		size_t page = m->backingpage + (addr - m->start) / PAGESIZE;
+		if (!(dirty_snap->written[page / 64] & (1ULL << (page % 64))))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Make sure a saved mapping still exists with its original protection
+ *
+ * The pages of a tracked mapping are either still write-protected, or
+ * writable after a caught write. Any other protection was set by the
+ * program, which may have written the mapping unseen.
+ *
+ * @return True if the mapping had to be recreated or its writes were not all
+ * caught, so none of its pages can be trusted
+ */
+static bool dirty_restore_mapping(struct dirty_mapping *m)
+{
+	struct dirty_mapping_list *current = &dirty_snap->current;
+	size_t covered = 0;
+	bool sameprot = true;
+	bool alldirty = m->allwritten;
+	for (unsigned int i = 0;i < current->size;i++) {
+		struct dirty_mapping *c = &current->array[i];
+		uintptr_t start = c->start > m->start ? c->start : m->start;
+		uintptr_t end = c->end < m->end ? c->end : m->end;
+		if (start < end) {
+			covered += end - start;
+			if (!m->tracked) {
+				if (c->prot != m->prot)
+					sameprot = false;
+			} else if (c->prot == m->prot) {
+				if (!alldirty && !dirty_all_written(m, start, end))
+					alldirty = true;
+			} else if (c->prot != (m->prot & ~PROT_WRITE)) {
+				sameprot = false;
+				alldirty = true;
+			}
+		}
+	}
+	if (covered != m->end - m->start) {
+		int flags = MAP_PRIVATE | MAP_ANON | MAP_FIXED | (m->hugetlb ? MAP_HUGETLB : 0);
+		if (mmap((void *)m->start, m->end - m->start, m->prot, flags, -1, 0) == MAP_FAILED) {
+			perror("mmap");
+			exit(EXIT_FAILURE);
+		}
+		return true;
+	}
+	/* A tracked mapping is restored in full through its original protection */
+	if ((!sameprot || (m->tracked && alldirty)) && mprotect((void *)m->start, m->end - m->start, m->prot) < 0) {
+		perror("mprotect");
+		exit(EXIT_FAILURE);
+	}
+	return alldirty;
+}
+
+/** @brief Drop a range of pages that were not present at the snapshot */
+static void dirty_drop_pages(uintptr_t start, uintptr_t end)
+{
+	if (start == end)
+		return;
+	/* Huge page mappings cannot drop single 4kB pages; zero them instead */
+	if (madvise((void *)start, end - start, MADV_DONTNEED) < 0)
+		memset((void *)start, 0, end - start);
+}
+
+/**
+ * @brief Roll the contents of a writable mapping back to the snapshot
+ *
+ * Pages saved at the snapshot are copied back if they may have changed; pages
+ * that were not there at the snapshot are dropped again, which zero-fills
+ * anonymous memory and reverts file-backed memory to the file.
+ */
+static void dirty_restore_pages(struct dirty_mapping *m, bool alldirty)
+{
+	/* The written pages of tracked mappings are restored from their list */
+	if (m->tracked && !alldirty)
+		return;
+	alldirty |= m->hugetlb;
+	uint64_t entries[PAGEMAP_BATCH];
+	size_t mpages = (m->end - m->start) / PAGESIZE;
+	uintptr_t dropstart = 0, dropend = 0;
+	for (size_t off = 0;off < mpages;off += PAGEMAP_BATCH) {
+		size_t num = mpages - off < PAGEMAP_BATCH ? mpages - off : PAGEMAP_BATCH;
+		dirty_read_pagemap(m->start + off * PAGESIZE, num, entries);
+		for (size_t j = 0;j < num;j++) {
+			uintptr_t addr = m->start + (off + j) * PAGESIZE;
+			size_t page = m->backingpage + off + j;
+			bool present = entries[j] & (PM_PRESENT | PM_SWAPPED);
+			bool dirty = alldirty || !dirty_snap->softdirty || (entries[j] & PM_SOFT_DIRTY);
+			if (dirty_snap->saved[page / 64] & (1ULL << (page % 64))) {
+				if (dirty || !present)
+					memcpy((char *)addr, dirty_snap->backing + page * PAGESIZE, PAGESIZE);
+			} else if (present && dirty) {
+				/* Batch up runs of pages to drop */
+				if (addr != dropend) {
+					dirty_drop_pages(dropstart, dropend);
+					dropstart = addr;
+				}
+				dropend = addr + PAGESIZE;
+			}
+		}
+	}
+	dirty_drop_pages(dropstart, dropend);
+}
+
+/**
+ * @brief Roll the pages caught as written back to the snapshot, and
+ * write-protect all tracked mappings again
+ */
+static void dirty_restore_written()
+{
+	for (size_t i = 0;i < dirty_snap->numwritten;i++) {
+		uintptr_t addr = dirty_snap->writtenpages[i];
+		struct dirty_mapping *m = dirty_find_mapping(&dirty_snap->mappings, addr);
+		size_t page = m->backingpage + (addr - m->start) / PAGESIZE;
+		dirty_snap->written[page / 64] &= ~(1ULL << (page % 64));
+		/* Mappings restored in full are protected again below */
+		if (m->allwritten)
+			continue;
+		if (dirty_snap->saved[page / 64] & (1ULL << (page % 64)))
+			memcpy((char *)addr, dirty_snap->backing + page * PAGESIZE, PAGESIZE);
+		else
+			dirty_drop_pages(addr, addr + PAGESIZE);
+		if (dirty_write_protect(m, addr, addr + PAGESIZE) < 0) {
+			perror("mprotect");
+			exit(EXIT_FAILURE);
+		}
+	}
+	dirty_snap->numwritten = 0;
+
+	struct dirty_mapping_list *list = &dirty_snap->mappings;
+	for (unsigned int i = 0;i < list->size;i++) {
+		struct dirty_mapping *m = &list->array[i];
+		if (m->tracked && m->allwritten) {
+			if (dirty_write_protect(m, m->start, m->end) < 0) {
+				perror("mprotect");
+				exit(EXIT_FAILURE);
+			}
+			m->allwritten = false;
+		}
+	}
+	dirty_mark_rseq_written();
+}
+
+/**
+ * @brief Roll the process back to the snapshot, in-process
+ *
+ * Runs on the shared stack, since the regular stack is overwritten.
+ */
+static void dirty_restore()
+{
+	abandon_all_threads();
+
+	/* Shrink (or regrow) the heap first, so its pages are checked below */
+	syscall(SYS_brk, dirty_snap->brk);
+
+	struct dirty_mapping_list *current = &dirty_snap->current;
+	dirty_read_mappings(current);
+	for (unsigned int i = 0;i < current->size;i++) {
+		struct dirty_mapping *c = &current->array[i];
+		if (!dirty_overlaps(&dirty_snap->mappings, c->start, c->end))
+			munmap((void *)c->start, c->end - c->start);
+	}
+
+	struct dirty_mapping_list *list = &dirty_snap->mappings;
+	for (unsigned int i = 0;i < list->size;i++) {
+		struct dirty_mapping *m = &list->array[i];
+		if (!(m->prot & PROT_WRITE))
+			continue;
+		bool alldirty = dirty_restore_mapping(m);
+		if (m->tracked)
+			m->allwritten = alldirty;
+		dirty_restore_pages(m, alldirty);
+	}
+
+	if (dirty_snap->softdirty)
+		dirty_clear_refs();
+	else
+		dirty_restore_written();
+
+	for (int i = 0;i < 3;i++)
+		if (dirty_snap->stdfds[i] >= 0)
+			dup2(dirty_snap->stdfds[i], i);
+	dirty_for_each_fd(dirty_restore_fd);
+
+	setcontext(&shared_ctxt);
+}
+
+static void dirty_loop()
+{
+	dirty_capture();
+	setcontext(&shared_ctxt);
+}
+
+static void dirty_startExecution()
+{
+	if (!dirty_snap)
+		dirty_snapshot_init();
+}
+
+static snapshot_id dirty_take_snapshot()
+{
+	if (model->params.numprocs > 1 && !model->params.nofork && !farm)
+		fork_farm(model->params.numprocs);
+
+	fork_snap->mRollbackStart = 0;
+	create_context(&dirty_ctxt, fork_snap->mStackBase, fork_snap->mStackSize, dirty_loop);
+	model_swapcontext(&shared_ctxt, &dirty_ctxt);
+	DEBUG("TAKESNAPSHOT RETURN\n");
+	uint64_t now = snapshot_now();
+	if (fork_snap->mRollbackStart != 0)
+		histogram_add(&fork_snap->mStats.rollbacktime, now - fork_snap->mRollbackStart);
+	fork_snap->mExecStart = now;
+	return 0;
+}
+
+static void dirty_roll_back(snapshot_id theID)
+{
+	DEBUG("Rollback\n");
+	fork_snap->mRollbackStart = snapshot_now();
+	histogram_add(&fork_snap->mStats.exectime, fork_snap->mRollbackStart - fork_snap->mExecStart);
+	create_context(&dirty_ctxt, fork_snap->mStackBase, fork_snap->mStackSize, dirty_restore);
+	setcontext(&dirty_ctxt);
+}
+
 /**
  * @brief Initializes the snapshot system
  * @param entryPoint the function that should run the program.
@@ -197,7 +1706,10 @@ void snapshot_system_init(unsigned int numheappages)
 }
 
 void startExecution() {
-	fork_startExecution();
+	if (use_dirty_snapshots())
+		dirty_startExecution();
+	else
+		fork_startExecution();
 }
 
 /** Takes a snapshot of memory.
@@ -205,6 +1717,8 @@ void startExecution() {
  */
 snapshot_id take_snapshot()
 {
+	if (use_dirty_snapshots())
+		return dirty_take_snapshot();
 	return fork_take_snapshot();
 }
 
@@ -213,5 +1727,8 @@ snapshot_id take_snapshot()
  */
 void snapshot_roll_back(snapshot_id theID)
 {
-	fork_roll_back(theID);
+	if (use_dirty_snapshots())
+		dirty_roll_back(theID);
+	else
+		fork_roll_back(theID);
 }
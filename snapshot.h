@@ -9,6 +9,15 @@
 #include "config.h"
 #include "mymemory.h"
 
+/** Default size of the shared (non-snapshot) memory heap */
+#define SHARED_MEMORY_DEFAULT  (200 * ((size_t)1 << 20))
+/** Default size of the shared stack, which is mapped right after the heap */
+#define STACK_SIZE_DEFAULT      (((size_t)1 << 20) * 20)
+/** Default size (in pages) of the snapshot heap */
+#define SNAPSHOT_HEAP_PAGES 100000
+
 mspace create_shared_mspace();
+bool snapshot_parse_size(const char *arg, size_t *size);
+bool snapshot_parse_hugepages(const char *arg, int *hugepages);
 
 #endif
@@ -2,6 +2,7 @@
 #define __STL_MODEL_H__
 
 #include <list>
+#include <string.h>
 #include "mymemory.h"
 typedef unsigned int uint;
 
@@ -172,7 +173,7 @@ public:
 	_Tp getVal() {return val;}
 	sllnode<_Tp> * getNext() {return next;}
 	sllnode<_Tp> * getPrev() {return prev;}
-	SNAPSHOTALLOC;
+	SNAPSHOTPOOLALLOC;
 
 private:
 	sllnode<_Tp> * next;
@@ -467,13 +468,13 @@ public:
 	SnapVector(uint _capacity = VECTOR_DEFCAP) :
 		_size(0),
 		capacity(_capacity),
-		array((type *) snapshot_malloc(sizeof(type) * _capacity)) {
+		array((type *) snapshot_pool_malloc(sizeof(type) * _capacity)) {
 	}
 
 	SnapVector(uint _capacity, type *_array)  :
 		_size(_capacity),
 		capacity(_capacity),
-		array((type *) snapshot_malloc(sizeof(type) * _capacity)) {
+		array((type *) snapshot_pool_malloc(sizeof(type) * _capacity)) {
 		memcpy(array, _array, capacity * sizeof(type));
 	}
 	void pop_back() {
@@ -489,18 +490,16 @@ public:
 			_size = psize;
 			return;
 		} else if (psize > capacity) {
-			array = (type *)snapshot_realloc(array, (psize <<1 )* sizeof(type));
-			capacity = psize << 1;
+			grow(psize << 1);
 		}
-		bzero(&array[_size], (psize - _size) * sizeof(type));
+		/* Elements are zero-filled bytewise; see grow */
+		bzero((void *)&array[_size], (psize - _size) * sizeof(type));
 		_size = psize;
 	}
 
 	void push_back(type item) {
 		if (_size >= capacity) {
-			uint newcap = capacity << 1;
-			array = (type *)snapshot_realloc(array, newcap * sizeof(type));
-			capacity = newcap;
+			grow(capacity << 1);
 		}
 		array[_size++] = item;
 	}
@@ -560,7 +559,7 @@ public:
 	}
 
 	~SnapVector() {
-		snapshot_free(array);
+		snapshot_pool_free(array, capacity * sizeof(type));
 	}
 
 	void clear() {
@@ -569,6 +568,18 @@ public:
 
 	SNAPSHOTALLOC;
 private:
+	/* Small arrays come from the snapshot pool, so they are moved rather
+	 * than reallocated.  Element types (including WriteIndex and
+	 * actionlist) must be valid when all zero and relocatable bytewise;
+	 * actionlist users fix up parent pointers after a move. */
+	void grow(uint newcap) {
+		type *newarray = (type *)snapshot_pool_malloc(newcap * sizeof(type));
+		memcpy((void *)newarray, (const void *)array, _size * sizeof(type));
+		snapshot_pool_free(array, capacity * sizeof(type));
+		array = newarray;
+		capacity = newcap;
+	}
+
 	uint _size;
 	uint capacity;
 	type *array;
@@ -0,0 +1,77 @@
+/**
+ * Instrumented accesses per second, through each entry point the LLVM
+ * pass calls: store_N/load_N, cds_storeN/cds_loadN and the volatile
+ * cds_volatile_storeN/cds_volatile_loadN, at each size.  One thread
+ * stores and loads its way through an 8 KB array, so every check finds
+ * its own earlier access and no race.  Volatile accesses also go through
+ * the scheduler, so there are fewer of them.  Compare builds of the
+ * library, e.g. before and after a change to the race detector.
+ *
+ * Run one execution: C11TESTER="-x 1" ./bench-accesses
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "cmodelint.h"
+#include "librace.h"
+#include "model-snapshot.h"
+
+#define BYTES 8192
+#define PAIRS 4000000
+#define VOLATILEPAIRS 100000
+
+static uint64_t data[BYTES / 8];
+
+static struct timespec start;
+
+static void report(const char *what, int size, int pairs)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "bench-accesses: %-8s %2d bit: %6.1f M accesses/s\n", what, size, 2.0 * pairs / seconds / 1e6);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+#define BENCH(size)                                                     \
+	static void bench ## size()                                           \
+	{                                                                     \
+		uint ## size ## _t *array = (uint ## size ## _t *)data;             \
+		const int n = BYTES / (size / 8);                                   \
+		uint ## size ## _t sum = 0;                                         \
+		clock_gettime(CLOCK_MONOTONIC, &start);                             \
+		for (int i = 0;i < PAIRS;i++) {                                     \
+			store_ ## size(&array[i % n], i);                                 \
+			sum += load_ ## size(&array[(i + 1) % n]);                        \
+		}                                                                   \
+		report("store_N", size, PAIRS);                                     \
+		for (int i = 0;i < PAIRS;i++) {                                     \
+			cds_store ## size(&array[i % n]);                                 \
+			array[i % n] = i;                                                 \
+			cds_load ## size(&array[(i + 1) % n]);                            \
+			sum += array[(i + 1) % n];                                        \
+		}                                                                   \
+		report("cds", size, PAIRS);                                         \
+		for (int i = 0;i < VOLATILEPAIRS;i++) {                             \
+			cds_volatile_store ## size(&array[i % n], i, "bench");           \
+			sum += cds_volatile_load ## size(&array[(i + 1) % n], "bench");  \
+		}                                                                   \
+		report("volatile", size, VOLATILEPAIRS);                            \
+		array[0] = sum;                                                     \
+	}
+
+BENCH(8)
+BENCH(16)
+BENCH(32)
+BENCH(64)
+
+int main()
+{
+	/* Starts the checker before the first access */
+	model_snapshot_point();
+	bench8();
+	bench16();
+	bench32();
+	bench64();
+	return 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * Cost of ClockVector::merge and ClockVector::synchronized_since at a few
+ * vector widths, called directly rather than through a program's
+ * actions.  For each width, PAIRS pairs of vectors with random clocks are
+ * merged ROUNDS times over (after the first round the merges find nothing
+ * to change, which is the common case), and each vector is asked whether
+ * it synchronized since one of PAIRS actions with random threads and
+ * clocks.  Prints millions of calls per second; compare builds, or CPUs
+ * with and without AVX2.
+ *
+ * Run one execution: C11TESTER="-x 1" ./bench-clockvector
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "action.h"
+#include "clockvector.h"
+#include "threads-model.h"
+#include "model-snapshot.h"
+
+#define PAIRS 1024
+#define ROUNDS 2000
+#define MAXWIDTH 64
+
+static const int widths[] = { 4, 8, 16, 64 };
+
+static Thread *threads[MAXWIDTH];
+
+/** @brief An action of a thread at a clock */
+static ModelAction * make_action(int thread, modelclock_t clock)
+{
+	ModelAction *act = new ModelAction(ATOMIC_NOP, std::memory_order_relaxed, NULL, VALUE_NONE, threads[thread]);
+	act->set_seq_number(clock);
+	return act;
+}
+
+/** @brief A vector of width clocks, each random */
+static ClockVector * make_vector(int width)
+{
+	ClockVector *cv = NULL;
+	for (int i = 0;i < width;i++) {
+		ModelAction *act = make_action(i, 1 + random() % 1000000);
+		ClockVector *next = new ClockVector(cv, act);
+		delete cv;
+		delete act;
+		cv = next;
+	}
+	return cv;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main()
+{
+	/* Starts the checker, which these vectors are allocated from */
+	model_snapshot_point();
+	for (int i = 0;i < MAXWIDTH;i++)
+		threads[i] = new Thread(int_to_id(i));
+	static ClockVector *dst[PAIRS], *src[PAIRS];
+	static ModelAction *acts[PAIRS];
+	for (unsigned int w = 0;w < sizeof(widths) / sizeof(widths[0]);w++) {
+		int width = widths[w];
+		for (int i = 0;i < PAIRS;i++) {
+			dst[i] = make_vector(width);
+			src[i] = make_vector(width);
+			acts[i] = make_action(random() % width, 1 + random() % 1000000);
+		}
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int r = 0;r < ROUNDS;r++)
+			for (int i = 0;i < PAIRS;i++)
+				dst[i]->merge(src[i]);
+		double merge = seconds_since(&start);
+
+		unsigned int synced = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int r = 0;r < ROUNDS;r++)
+			for (int i = 0;i < PAIRS;i++)
+				synced += dst[i]->synchronized_since(acts[(i + r) % PAIRS]);
+		double since = seconds_since(&start);
+
+		fprintf(stderr, "bench-clockvector: width %2d: merge %6.1f M/s, synchronized_since %6.1f M/s (%u synced)\n",
+						width, (double)ROUNDS * PAIRS / merge / 1e6, (double)ROUNDS * PAIRS / since / 1e6, synced);
+		for (int i = 0;i < PAIRS;i++) {
+			delete dst[i];
+			delete src[i];
+			delete acts[i];
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * Rollback cost as the heap grows, for comparing fork with the in-process
+ * rollback of -n.  A global array of MB megabytes (default 64, at most
+ * 256) is filled before model_snapshot_point().  Each execution then
+ * writes 8 bytes in each of 8 pages of it, from a second thread, after
+ * one atomic handoff.  Compare the "Fork time", "Exit/teardown time" and
+ * "Restore time" lines of the summary.
+ *
+ * Run with fork:  C11TESTER="-x 100" ./bench-rollback MB
+ * Run in-process: C11TESTER="-x 100 -n" ./bench-rollback MB
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cmodelint.h"
+#include "model-snapshot.h"
+
+#define MAXMB 256
+#define PAGE 4096
+#define WRITES 8
+
+static char heap[MAXMB << 20];
+static uint64_t ready;
+static size_t size;
+
+static void * writer(void *arg)
+{
+	while (!cds_atomic_load64(&ready, 2, "writer"))
+		;
+	for (int i = 0;i < WRITES;i++)
+		*(uint64_t *)&heap[(size / WRITES) * i / PAGE * PAGE] = i;
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int mb = argc > 1 ? atoi(argv[1]) : 64;
+	if (mb < 1 || mb > MAXMB) {
+		fprintf(stderr, "bench-rollback: MB must be 1 to %d\n", MAXMB);
+		return 1;
+	}
+	size = (size_t)mb << 20;
+	memset(heap, 1, size);
+	cds_atomic_init64(&ready, 0, "main");
+	model_snapshot_point();
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, writer, NULL);
+	cds_atomic_store64(&ready, 1, 3, "main");
+	pthread_join(thread, NULL);
+	return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * Race detector cost at many threads and large clocks, for comparing the
+ * 128 bit shadow cells with the 64 bit ones (COMPACT_SHADOW_CELLS in
+ * config.h).  The main thread drives its clock past 2^25 with atomics,
+ * then 128 threads make plain accesses to words of their own, for about
+ * 100M operations in all.  With COMPACT_SHADOW_CELLS the words the
+ * threads touch fall back to full records; compare "expandedrecords" and
+ * the time.
+ *
+ * Run one execution: C11TESTER="-x 1 --racestats" ./bench-widecells
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "cmodelint.h"
+#include "librace.h"
+
+#define THREADS 128
+#define ATOMICS 34000000
+#define PLAIN 250000
+
+static uint64_t counter;
+static uint64_t words[THREADS][8];
+
+static void * worker(void *arg)
+{
+	long id = (long)arg;
+	uint64_t sum = 0;
+	for (int i = 0;i < PLAIN;i++) {
+		store_64(&words[id][i & 7], i);
+		sum += load_64(&words[id][(i + 3) & 7]);
+	}
+	words[id][0] = sum;
+	return NULL;
+}
+
+int main()
+{
+	cds_atomic_init64(&counter, 0, "main");
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0;i < ATOMICS;i++)
+		cds_atomic_fetch_add64(&counter, 1, 0, "main");
+	pthread_t threads[THREADS];
+	for (long i = 0;i < THREADS;i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (int i = 0;i < THREADS;i++)
+		pthread_join(threads[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(stderr, "bench-widecells: %.1f s\n",
+					(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	return 0;
+}
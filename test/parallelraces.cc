@@ -0,0 +1,28 @@
+/**
+ * A parallel run reports each race once, however many workers find it:
+ * "reportedraces" is 3 in RACESTATS with -j 2, as in a serial run.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include "librace.h"
+
+static uint64_t a, b, c;
+
+static void * worker(void *arg)
+{
+	store_64(&a, 1);
+	store_64(&b, 1);
+	store_64(&c, 1);
+	return NULL;
+}
+
+int main()
+{
+	pthread_t thread;
+	pthread_create(&thread, NULL, worker, NULL);
+	load_64(&a);
+	load_64(&b);
+	load_64(&c);
+	pthread_join(thread, NULL);
+	return 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * A race that every execution runs into is unwound only until the race set
+ * has shown it to repeat a printed race.  With -x 5, the race on shared is
+ * unwound in the first two executions, and "filteredraces" counts the 3
+ * later ones.  The race on twice is at one site in get(), reached from two
+ * callers: both stacks are reported, and the filter never drops either, so
+ * "reportedraces" is 3 and its 8 repeats are unwound into "duplicateraces"
+ * (9 with the one of shared).
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include "librace.h"
+
+static uint64_t shared, twice;
+
+/* The callers use the results, so that none of the calls is a tail call
+ * and each caller stays on the stack. */
+static uint64_t __attribute__((noinline)) get(uint64_t *p)
+{
+	return load_64(p) + 1;
+}
+
+static uint64_t __attribute__((noinline)) from_a()
+{
+	return get(&twice) * 2;
+}
+
+static uint64_t __attribute__((noinline)) from_b()
+{
+	return get(&twice) * 3;
+}
+
+static void * worker(void *arg)
+{
+	load_64(&shared);
+	return (void *)(uintptr_t)(from_a() + from_b());
+}
+
+int main()
+{
+	pthread_t thread;
+	pthread_create(&thread, NULL, worker, NULL);
+	store_64(&shared, 1);
+	store_64(&twice, 1);
+	pthread_join(thread, NULL);
+	return 0;
+}
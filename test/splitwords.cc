@@ -0,0 +1,43 @@
+/**
+ * Words of an int array that only see 32-bit accesses get a cell per int,
+ * and are never split for mixed sizes: "splitwords" stays 0 in RACESTATS.
+ * The two threads use the two halves of every word, so a word cell shared
+ * by both ints would report a race.  A 64-bit atomic that is initialized
+ * by a plain store keeps its single word cell when it is then accessed
+ * atomically: "lanewords" only counts the 32 words of the array and the
+ * word of start, 33 per execution.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include "cmodelint.h"
+#include "librace.h"
+
+#define N 64
+
+static uint32_t array[N] __attribute__((aligned(8)));
+static uint32_t start;
+static uint64_t ready;
+
+static void * worker(void *arg)
+{
+	long lane = (long)arg;
+	cds_atomic_load64(&ready, 0, "worker");
+	for (int i = lane;i < N;i += 2)
+		store_32(&array[i], load_32(&array[i]) + 1);
+	return NULL;
+}
+
+int main()
+{
+	cds_atomic_init32(&start, 0, "main");
+	store_64(&ready, 1);
+	pthread_t threads[2];
+	for (long i = 0;i < 2;i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (int i = 0;i < 2;i++)
+		pthread_join(threads[i], NULL);
+	cds_atomic_store64(&ready, 2, 0, "main");
+	for (int i = 0;i < N;i++)
+		load_32(&array[i]);
+	return 0;
+}
@@ -49,6 +49,7 @@ public:
 	~Thread();
 	void complete();
 	void freeResources();
+	void abandon();
 
 	static int swap(ucontext_t *ctxt, Thread *t);
 	static int swap(Thread *t, ucontext_t *ctxt);
@@ -207,6 +208,7 @@ Thread * thread_current();
 thread_id_t thread_current_id();
 void thread_startup();
 void initMainThread();
+void abandon_all_threads();
 
 static inline thread_id_t thrd_to_id(thrd_t t)
 {
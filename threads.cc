@@ -17,6 +17,8 @@
 #include "clockvector.h"
 
 #include <dlfcn.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 #ifdef TLS
 uintptr_t get_tls_addr() {
@@ -78,9 +80,12 @@ void modelexit() {
 	model->switch_thread(new ModelAction(THREAD_FINISH, std::memory_order_seq_cst, thread_current()));
 }
 
+extern "C" void *__libc_stack_end;
+
 void initMainThread() {
 	atexit(modelexit);
 	Thread * curr_thread = thread_current();
+	setThreadStackTop(curr_thread->get_id(), __libc_stack_end);
 	model->switch_thread(new ModelAction(THREAD_START, std::memory_order_seq_cst, curr_thread));
 }
 
@@ -97,6 +102,9 @@ void thread_startup()
 	model->switch_thread(new ModelAction(THREAD_START, std::memory_order_seq_cst, curr_thread));
 #endif
 
+	/* The program's frames for this thread start below this one */
+	setThreadStackTop(curr_thread->get_id(), __builtin_frame_address(0));
+
 	/* Call the actual thread function */
 	if (curr_thread->start_routine != NULL) {
 		curr_thread->start_routine(curr_thread->arg);
@@ -209,6 +217,10 @@ void real_init_all() {
 }
 
 #ifdef TLS
+/* Pages at the top of a helper thread's model stack that it writes before
+ * switching to it */
+#define HELPERSTACKPAGES 4
+
 void finalize_helper_thread() {
 	Thread * curr_thread = thread_current();
 	real_pthread_mutex_lock(&curr_thread->mutex);
@@ -237,6 +249,11 @@ void * helper_thread(void * ptr) {
 
 	/* Initialize new managed context */
 	curr_thread->helper_stack = stack_allocate(STACK_SIZE);
+	/* Write the top of the new stack while still on this thread's own one:
+	 * in-process snapshots may write-protect it, and this thread has no
+	 * signal stack to handle a fault on the stack it runs on */
+	for (size_t off = PAGESIZE;off <= HELPERSTACKPAGES * PAGESIZE;off += PAGESIZE)
+		((volatile char *)curr_thread->helper_stack)[STACK_SIZE - off] = 0;
 	curr_thread->helpercontext.uc_stack.ss_sp = curr_thread->helper_stack;
 	curr_thread->helpercontext.uc_stack.ss_size = STACK_SIZE;
 	curr_thread->helpercontext.uc_stack.ss_flags = 0;
@@ -393,6 +410,59 @@ void Thread::freeResources() {
 	state = THREAD_FREED;
 }
 
+#ifdef TLS
+/** @brief Entry point for waking a parked helper thread only to exit it */
+static void helper_thread_exit()
+{
+	/* Skip the pthread cleanup, which would run the user's TLS destructors */
+	syscall(SYS_exit, 0);
+}
+#endif
+
+/**
+ * @brief Tear down a thread which may not have finished, for an in-process
+ * rollback
+ *
+ * Unlike freeResources(), this never resumes the thread's user code: the
+ * helper thread is woken on a context (on the thread's model stack) that exits
+ * it right away. Memory is not freed, since the rollback restores it anyway.
+ */
+void Thread::abandon()
+{
+#ifdef TLS
+	if (this != model->getInitThread() && tls != NULL) {
+		getcontext(&context);
+		context.uc_stack.ss_sp = stack;
+		context.uc_stack.ss_size = STACK_SIZE;
+		context.uc_stack.ss_flags = 0;
+		context.uc_link = NULL;
+		makecontext(&context, helper_thread_exit, 0);
+		real_pthread_mutex_unlock(&mutex2);
+		real_pthread_join(thread, NULL);
+	}
+#endif
+	state = THREAD_FREED;
+}
+
+/**
+ * @brief Tear down all threads of the current execution
+ *
+ * Must be called from a system context, right before the memory of the process
+ * is rolled back in-process.
+ */
+void abandon_all_threads()
+{
+#ifdef TLS
+	set_tls_addr((uintptr_t)model->getInitThread()->tls);
+#endif
+	ModelExecution *execution = model->get_execution();
+	for (unsigned int i = 0;i < execution->get_num_threads();i++) {
+		Thread *thr = execution->get_thread(int_to_id(i));
+		if (!thr->is_freed())
+			thr->abandon();
+	}
+}
+
 /**
  * @brief Construct a new model-checker Thread
  *
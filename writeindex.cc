@@ -0,0 +1,141 @@
+#include <string.h>
+
+#include "writeindex.h"
+#include "action.h"
+#include "common.h"
+
+/* Removed entries are dropped from the array once there are this many and
+ * they make up half of it */
+#define MINCOMPACT 16
+
+WriteIndex::WriteIndex() :
+	entries(NULL),
+	num(0),
+	capacity(0),
+	numremoved(0)
+{
+}
+
+WriteIndex::~WriteIndex()
+{
+	if (entries != NULL)
+		snapshot_free(entries);
+}
+
+/**
+ * @brief Adds a write of the thread to the index
+ *
+ * Writes normally come in sequence number order; a write with an earlier
+ * sequence number (a converted non-atomic store) is put in its place.
+ */
+void WriteIndex::add(ModelAction *write)
+{
+	if (num == capacity) {
+		capacity = capacity == 0 ? 4 : capacity << 1;
+		entries = (struct write_entry *)snapshot_realloc(entries, capacity * sizeof(struct write_entry));
+	}
+	modelclock_t seq = write->get_seq_number();
+	int index = num;
+	if (num != 0 && entries[num - 1].seq > seq) {
+		index = lastBefore(seq) + 1;
+		memmove(&entries[index + 1], &entries[index], (num - index) * sizeof(struct write_entry));
+		/* Links above the new entry move up with their entries */
+		for (int i = index + 1;i <= num;i++)
+			entries[i].rmwprev = entries[i].rmwprev == i - 1 ? i : i - 1;
+	}
+	entries[index].seq = seq;
+	entries[index].write = write;
+	entries[index].rmwprev = index;
+	entries[index].rmwconsumed = false;
+	num++;
+}
+
+/** @brief Removes a write that is about to be freed */
+void WriteIndex::remove(const ModelAction *write)
+{
+	int index = find(write);
+	if (index < 0)
+		return;
+	entries[index].write = NULL;
+	entries[index].rmwprev = index - 1;
+	if (++numremoved >= MINCOMPACT && numremoved * 2 > num)
+		compact();
+}
+
+/** @brief Records that an RMW reads from a write, so no other RMW may */
+void WriteIndex::setRMWConsumed(const ModelAction *write)
+{
+	int index = find(write);
+	if (index < 0)
+		return;
+	entries[index].rmwconsumed = true;
+	entries[index].rmwprev = index - 1;
+}
+
+/** @return The entry of a write, or -1 if it is not in the index */
+int WriteIndex::find(const ModelAction *write) const
+{
+	modelclock_t seq = write->get_seq_number();
+	for (int index = lastBefore(seq);index >= 0 && entries[index].seq == seq;index--)
+		if (entries[index].write == write)
+			return index;
+	return -1;
+}
+
+/** @return The last entry with a sequence number up to clock, or -1 */
+int WriteIndex::lastBefore(modelclock_t clock) const
+{
+	int low = 0, high = num;
+	while (low < high) {
+		int mid = (low + high) >> 1;
+		if (entries[mid].seq <= clock)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low - 1;
+}
+
+/** @return The last entry with a sequence number up to clock whose write
+ *  was not removed, or -1 */
+int WriteIndex::lastLiveBefore(modelclock_t clock) const
+{
+	int index = lastBefore(clock);
+	while (index >= 0 && entries[index].write == NULL)
+		index--;
+	return index;
+}
+
+/**
+ * @brief Finds the closest entry at or before index that an RMW may read
+ * from, skipping writes already read by an RMW and removed writes
+ * @return The entry, or -1 if there is none
+ */
+int WriteIndex::prevReadableByRMW(int index)
+{
+	int root = index;
+	while (root >= 0 && entries[root].rmwprev != root)
+		root = entries[root].rmwprev;
+	/* Shorten the links walked for the next search */
+	while (index > root) {
+		int next = entries[index].rmwprev;
+		entries[index].rmwprev = root;
+		index = next;
+	}
+	return root;
+}
+
+/** @brief Drops the entries of removed writes */
+void WriteIndex::compact()
+{
+	int newnum = 0;
+	for (int i = 0;i < num;i++) {
+		if (entries[i].write == NULL)
+			continue;
+		entries[newnum] = entries[i];
+		entries[newnum].rmwprev = entries[newnum].rmwconsumed ? newnum - 1 : newnum;
+		newnum++;
+	}
+	num = newnum;
+	numremoved = 0;
+}
@@ -0,0 +1,66 @@
+/** @file writeindex.h
+ *  @brief Index of the writes one thread made to one location.
+ */
+
+#ifndef __WRITEINDEX_H__
+#define __WRITEINDEX_H__
+
+#include "classlist.h"
+#include "modeltypes.h"
+
+/**
+ * @brief The writes one thread made to one location, in sequence number
+ * order
+ *
+ * Since a thread's writes that happen before an action are those with a
+ * sequence number up to the action's clock for the thread, they are a
+ * prefix of the index, found by binary search.  Each write also caches
+ * whether an RMW already reads from it, and the writes an RMW may still
+ * read from are linked so that reads skip the others.
+ *
+ * The same index, without RMWs, keeps the seq_cst fences of each thread.
+ *
+ * An index with all fields zero is empty and valid.
+ */
+class WriteIndex {
+public:
+	WriteIndex();
+	~WriteIndex();
+
+	void add(ModelAction *write);
+	void remove(const ModelAction *write);
+	void setRMWConsumed(const ModelAction *write);
+
+	/** @return The number of entries, including removed writes */
+	int size() const { return num; }
+	/** @return The write of an entry, or NULL if it was removed */
+	ModelAction * get(int index) const { return entries[index].write; }
+	/** @return Whether an RMW reads from the write of an entry */
+	bool isRMWConsumed(int index) const { return entries[index].rmwconsumed; }
+
+	int find(const ModelAction *write) const;
+	int lastBefore(modelclock_t clock) const;
+	int lastLiveBefore(modelclock_t clock) const;
+	int prevReadableByRMW(int index);
+
+	SNAPSHOTALLOC
+private:
+	struct write_entry {
+		modelclock_t seq;
+		/** @brief The write, or NULL once it is removed */
+		ModelAction *write;
+		/** @brief Link towards the closest earlier entry an RMW may read
+		 *  from; an entry it may read from links to itself */
+		int rmwprev;
+		bool rmwconsumed;
+	};
+
+	void compact();
+
+	struct write_entry *entries;
+	int num;
+	int capacity;
+	int numremoved;
+};
+
+#endif	/* __WRITEINDEX_H__ */